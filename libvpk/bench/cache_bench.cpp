@@ -0,0 +1,122 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#include <vpk/package.h>
+
+#include "synthetic_vpk.h"
+
+// Package::read() parsing the directory file with none of it in the
+// page cache, parsing it from the page cache and loading the index
+// from the cache of an earlier read instead. Without an argument a
+// package of 250000 files is generated.
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t FILES  = 250000;
+static const int    ROUNDS = 10;
+
+static int wrong = 0;
+
+// drops the clean pages of a file from the page cache
+static void evict(const boost::filesystem::path &path) {
+	int fd = open(path.string().c_str(), O_RDONLY);
+	if (fd < 0) {
+		perror(path.string().c_str());
+		exit(1);
+	}
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+// best time of all rounds in milliseconds
+static double run(const char *name, const boost::filesystem::path &path,
+		const std::string &cacheDir, bool cold, size_t files, double base) {
+	double best = 0;
+	for (int round = 0; round < ROUNDS; ++ round) {
+		if (cold) {
+			evict(path);
+		}
+
+		Vpk::Package package;
+		package.setCacheDir(cacheDir);
+		Clock::time_point start = Clock::now();
+		package.read(path);
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		if (package.filecount() != files) {
+			++ wrong;
+			printf("%-14s WRONG FILE COUNT: %zu, expected %zu\n", name, package.filecount(), files);
+			return 0;
+		}
+		if (round == 0 || ms < best) {
+			best = ms;
+		}
+	}
+
+	printf("%-14s %9.2f ms  %8.2f M files/s", name, best, files / best / 1e3);
+	if (base > 0) {
+		printf("  %6.2fx", base / best);
+	}
+	printf("\n");
+	return best;
+}
+
+int main(int argc, char *argv[]) {
+	boost::filesystem::path path = argc > 1 ? boost::filesystem::path(argv[1]) : writeSyntheticVpk(FILES);
+
+	size_t files = 0;
+	{
+		Vpk::Package package;
+		package.read(path);
+		files = package.filecount();
+	}
+	printf("%zu files, best of %d reads\n", files, ROUNDS);
+
+	boost::filesystem::path cacheDir = boost::filesystem::temp_directory_path() /
+		boost::filesystem::unique_path("vpkbench-cache-%%%%-%%%%");
+	{
+		// writes the cache
+		Vpk::Package package;
+		package.setCacheDir(cacheDir.string());
+		package.read(path);
+		if (!boost::filesystem::exists(package.cachePath())) {
+			++ wrong;
+			printf("NO CACHE WRITTEN to %s\n", package.cachePath().string().c_str());
+		}
+	}
+
+	double warm = run("warm parse", path, "", false, files, 0);
+	run("cold parse", path, "", true, files, warm);
+	run("cache load", path, cacheDir.string(), false, files, warm);
+
+	boost::filesystem::remove_all(cacheDir);
+	if (argc < 2) {
+		boost::filesystem::remove_all(path.parent_path());
+	}
+	return wrong == 0 ? 0 : 1;
+}
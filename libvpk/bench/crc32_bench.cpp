@@ -0,0 +1,94 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+
+#include <vector>
+#include <chrono>
+
+#include <boost/crc.hpp>
+
+#include <vpk/crc32.h>
+
+// Throughput of every Crc32 kernel the CPU supports and of
+// boost::crc_32_type, over buffers of 64 bytes to 1 MiB.
+
+typedef std::chrono::steady_clock Clock;
+
+// bytes hashed per kernel and buffer size
+static const size_t VOLUME = 256 * 1024 * 1024;
+
+static double seconds(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static int wrong = 0;
+
+static void report(const char *name, size_t size, double seconds, uint32_t crc, uint32_t expected) {
+	if (crc != expected) {
+		++ wrong;
+	}
+	printf("%-14s %8zu B  %8.2f MB/s%s\n", name, size, VOLUME / seconds / 1e6,
+		crc == expected ? "" : "  WRONG CHECKSUM");
+}
+
+int main() {
+	std::vector<char> data(1024 * 1024);
+	uint32_t state = 1;
+	for (size_t i = 0; i < data.size(); ++ i) {
+		state = state * 1103515245 + 12345;
+		data[i] = state >> 16;
+	}
+
+	static const Vpk::Crc32::Kernel kernels[] = {
+		Vpk::Crc32::SLICING_BY_16,
+		Vpk::Crc32::PCLMUL,
+		Vpk::Crc32::VPCLMUL
+	};
+
+	printf("best kernel: %s\n", Vpk::Crc32::name(Vpk::Crc32::best()));
+	for (size_t size = 64; size <= data.size(); size *= 4) {
+		size_t rounds = VOLUME / size;
+
+		boost::crc_32_type boostCrc;
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < rounds; ++ i) {
+			boostCrc.reset();
+			boostCrc.process_bytes(data.data(), size);
+		}
+		uint32_t expected = boostCrc.checksum();
+		report("boost::crc", size, seconds(start), expected, expected);
+
+		for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++ k) {
+			if (!Vpk::Crc32::supported(kernels[k])) {
+				printf("%-14s not supported\n", Vpk::Crc32::name(kernels[k]));
+				continue;
+			}
+			Vpk::Crc32 crc(kernels[k]);
+			start = Clock::now();
+			for (size_t i = 0; i < rounds; ++ i) {
+				crc.reset();
+				crc.process(data.data(), size);
+			}
+			report(Vpk::Crc32::name(kernels[k]), size, seconds(start), crc.checksum(), expected);
+		}
+		printf("\n");
+	}
+
+	return wrong == 0 ? 0 : 1;
+}
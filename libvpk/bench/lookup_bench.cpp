@@ -0,0 +1,121 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <ctype.h>
+
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include <vpk/package.h>
+
+#include "synthetic_vpk.h"
+
+// Package::get() on the paths of a package with 100%, 50% and 0% hits,
+// case sensitive and insensitive. Misses only differ from existing
+// files in their name, so they walk the same hash chains. Without an
+// argument a package of 250000 files is generated.
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t FILES   = 250000;
+static const size_t LOOKUPS = 4 * 1000 * 1000;
+
+int main(int argc, char *argv[]) {
+	boost::filesystem::path path = argc > 1 ? boost::filesystem::path(argv[1]) : writeSyntheticVpk(FILES);
+
+	Vpk::Package package;
+	package.read(path);
+	const Vpk::Index &index = package.index();
+
+	// deep material paths like the engine looks up most, if there are any
+	std::vector<std::string> hits;
+	for (Vpk::Index::Id file = 0, n = index.files(); file < n; ++ file) {
+		std::string filepath = index.path(file);
+		if (filepath.compare(0, 17, "materials/models/") == 0) {
+			hits.push_back(filepath);
+		}
+	}
+	if (hits.size() < 1000) {
+		hits.clear();
+		for (Vpk::Index::Id file = 0, n = index.files(); file < n; ++ file) {
+			hits.push_back(index.path(file));
+		}
+	}
+	if (hits.empty()) {
+		fprintf(stderr, "no files in %s\n", path.string().c_str());
+		return 1;
+	}
+	std::mt19937 rng(1);
+	std::shuffle(hits.begin(), hits.end(), rng);
+
+	std::vector<std::string> misses(hits);
+	for (std::vector<std::string>::iterator i = misses.begin(); i != misses.end(); ++ i) {
+		i->insert(std::min(i->rfind('.'), i->size()), "_missing");
+	}
+
+	printf("%zu files, %zu paths looked up, %zu lookups per run\n", index.files(), hits.size(), LOOKUPS);
+
+	int wrong = 0;
+	for (int icase = 0; icase < 2; ++ icase) {
+		package.setIcase(icase != 0);
+		for (unsigned int percent = 100;; percent -= 50) {
+			// in case insensitive mode the paths are asked for in upper case
+			std::vector<std::string> queries(hits.size());
+			size_t expected = 0;
+			for (size_t i = 0; i < queries.size(); ++ i) {
+				bool hit = i * 100 / queries.size() < percent;
+				queries[i] = hit ? hits[i] : misses[i];
+				if (icase) {
+					std::transform(queries[i].begin(), queries[i].end(), queries[i].begin(), ::toupper);
+				}
+				expected += hit;
+			}
+			std::shuffle(queries.begin(), queries.end(), rng);
+
+			size_t found = 0, lookups = 0;
+			Clock::time_point start = Clock::now();
+			while (lookups < LOOKUPS) {
+				for (std::vector<std::string>::const_iterator i = queries.begin(); i != queries.end(); ++ i) {
+					found += package.get(i->data(), i->size()) != 0;
+				}
+				lookups += queries.size();
+			}
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+			bool correct = found == expected * (lookups / queries.size());
+			if (!correct) {
+				++ wrong;
+			}
+			printf("%-16s %3u%% hits  %8.1f ns/lookup  %8.2f M lookups/s%s\n",
+				icase ? "case insensitive" : "case sensitive", percent,
+				seconds * 1e9 / lookups, lookups / seconds / 1e6,
+				correct ? "" : "  WRONG RESULT");
+
+			if (percent == 0) break;
+		}
+	}
+
+	if (argc < 2) {
+		boost::filesystem::remove_all(path.parent_path());
+	}
+	return wrong == 0 ? 0 : 1;
+}
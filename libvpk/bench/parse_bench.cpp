@@ -0,0 +1,101 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+
+#include <string>
+#include <chrono>
+
+#include <vpk/package.h>
+#include <vpk/file_io.h>
+
+#include "synthetic_vpk.h"
+
+// Package::read() parsing the directory file through FileIO, from a
+// memory mapping and from a memory mapping in lazy mode, in entries
+// per second. The directory file stays in the page cache. Without an
+// argument a package of 250000 files is generated.
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t FILES  = 250000;
+static const int    ROUNDS = 10;
+
+enum Mode {
+	STREAM,
+	MAPPED,
+	LAZY
+};
+
+static int wrong = 0;
+
+// best time of all rounds in milliseconds
+static double run(const char *name, const boost::filesystem::path &path, Mode mode, size_t files, double base) {
+	double best = 0;
+	for (int round = 0; round < ROUNDS; ++ round) {
+		Vpk::Package package;
+		package.setLazy(mode == LAZY);
+		Clock::time_point start = Clock::now();
+		if (mode == STREAM) {
+			Vpk::FileIO io(path);
+			package.read(path, io);
+		}
+		else {
+			package.read(path);
+		}
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		// loading everything left outside of the timing
+		if (package.index().files() != files) {
+			++ wrong;
+			printf("%-12s WRONG FILE COUNT: %zu, expected %zu\n", name, package.index().files(), files);
+			return 0;
+		}
+		if (round == 0 || ms < best) {
+			best = ms;
+		}
+	}
+
+	printf("%-12s %9.2f ms  %8.2f M entries/s", name, best, files / best / 1e3);
+	if (base > 0) {
+		printf("  %6.2fx", base / best);
+	}
+	printf("\n");
+	return best;
+}
+
+int main(int argc, char *argv[]) {
+	boost::filesystem::path path = argc > 1 ? boost::filesystem::path(argv[1]) : writeSyntheticVpk(FILES);
+
+	size_t files = 0;
+	{
+		Vpk::Package package;
+		package.read(path);
+		files = package.index().files();
+	}
+	printf("%zu entries, best of %d reads\n", files, ROUNDS);
+
+	double stream = run("FileIO", path, STREAM, files, 0);
+	run("mmap", path, MAPPED, files, stream);
+	run("mmap, lazy", path, LAZY, files, stream);
+
+	if (argc < 2) {
+		boost::filesystem::remove_all(path.parent_path());
+	}
+	return wrong == 0 ? 0 : 1;
+}
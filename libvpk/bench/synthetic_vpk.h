@@ -0,0 +1,108 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_BENCH_SYNTHETIC_VPK_H
+#define VPK_BENCH_SYNTHETIC_VPK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/format.hpp>
+#include <boost/filesystem/operations.hpp>
+
+// Writes a version 1 directory file of a package laid out like those of
+// Source engine games: deep material and model paths with a few dozen
+// files per directory. The archives it refers to are not written.
+// Returns the path of the directory file, which is named
+// bench_dir.vpk and placed in a new temporary directory.
+
+static void putLU16(std::string &out, uint16_t value) {
+	out += (char) value;
+	out += (char) (value >> 8);
+}
+
+static void putLU32(std::string &out, uint32_t value) {
+	putLU16(out, value);
+	putLU16(out, value >> 16);
+}
+
+static boost::filesystem::path writeSyntheticVpk(size_t files) {
+	static const char *types[]      = {"vmt", "vtf", "mdl"};
+	static const char *categories[] = {
+		"props_c17", "props_junk", "props_interiors", "props_wasteland",
+		"weapons", "player", "humans", "props_vehicles"
+	};
+	static const size_t FILES_PER_DIR = 40;
+
+	std::string tree;
+	size_t dirs = (files + FILES_PER_DIR - 1) / FILES_PER_DIR;
+	size_t added = 0;
+	uint32_t offset = 0;
+	for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++ t) {
+		tree += types[t];
+		tree += '\0';
+		size_t first = dirs * t / 3, last = dirs * (t + 1) / 3;
+		for (size_t d = first; d < last; ++ d) {
+			tree += (boost::format("%s/%s/set%02u/variant%04u")
+				% (t == 2 ? "models" : "materials/models")
+				% categories[d % 8] % (unsigned int) (d / 8 % 32) % (unsigned int) d).str();
+			tree += '\0';
+			for (size_t f = 0; f < FILES_PER_DIR && added < files; ++ f, ++ added) {
+				tree += (boost::format("asset_%03u_skin%u") % (unsigned int) f % (unsigned int) (f % 3)).str();
+				tree += '\0';
+				uint32_t size = 512 + added % 4096;
+				putLU32(tree, (uint32_t) (added * 2654435761u)); // crc32
+				putLU16(tree, 0);                                // preload size
+				putLU16(tree, added % 16);                       // archive
+				putLU32(tree, offset);
+				putLU32(tree, size);
+				putLU16(tree, 0xFFFF);
+				offset += size;
+			}
+			tree += '\0';
+		}
+		tree += '\0';
+	}
+	tree += '\0';
+
+	std::string header;
+	putLU32(header, 0x55AA1234);
+	putLU32(header, 1);
+	putLU32(header, tree.size());
+
+	boost::filesystem::path dir = boost::filesystem::temp_directory_path() /
+		boost::filesystem::unique_path("vpkbench-%%%%-%%%%");
+	boost::filesystem::create_directories(dir);
+	boost::filesystem::path path = dir / "bench_dir.vpk";
+
+	FILE *out = fopen(path.string().c_str(), "wb");
+	if (!out ||
+		fwrite(header.data(), 1, header.size(), out) != header.size() ||
+		fwrite(tree.data(), 1, tree.size(), out) != tree.size() ||
+		fclose(out) != 0) {
+		perror(path.string().c_str());
+		exit(1);
+	}
+	return path;
+}
+
+#endif
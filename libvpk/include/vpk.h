@@ -21,6 +21,7 @@
 
 #include <vpk/version.h>
 #include <vpk/package.h>
+#include <vpk/index.h>
 #include <vpk/node.h>
 #include <vpk/dir.h>
 #include <vpk/file.h>
@@ -31,6 +32,9 @@
 #include <vpk/checking_data_handler_factory.h>
 #include <vpk/file_data_handler.h>
 #include <vpk/file_data_handler_factory.h>
+#include <vpk/tar_data_handler.h>
+#include <vpk/tar_data_handler_factory.h>
+#include <vpk/gzip_bundle.h>
 #include <vpk/exception.h>
 #include <vpk/file_format_error.h>
 
@@ -0,0 +1,63 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_ARENA_H
+#define VPK_ARENA_H
+
+#include <string.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace Vpk {
+	// A simple bump allocator. Memory is handed out of big blocks and
+	// only released all at once by clear() or the destructor. Destructors
+	// of objects placed into an arena are not run.
+	class Arena : private boost::noncopyable {
+	public:
+		Arena(size_t blockSize = 64 * 1024) :
+			m_blockSize(blockSize), m_used(0), m_ptr(0), m_end(0) {}
+		~Arena() { clear(); }
+
+		void *allocate(size_t size, size_t align = sizeof(void*));
+
+		template<typename T>
+		void *allocate() { return allocate(sizeof(T), alignof(T)); }
+
+		const char *strdup(const char *str, size_t length);
+		const char *strdup(const char *str) { return strdup(str, strlen(str)); }
+		const char *strdup(const std::string &str) { return strdup(str.c_str(), str.size()); }
+
+		void clear();
+
+		// bytes handed out so far
+		size_t used() const { return m_used; }
+
+	private:
+		std::vector<char*> m_blocks;
+		size_t m_blockSize;
+		size_t m_used;
+		char  *m_ptr;
+		char  *m_end;
+	};
+}
+
+#endif
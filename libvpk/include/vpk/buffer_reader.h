@@ -0,0 +1,105 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_BUFFER_READER_H
+#define VPK_BUFFER_READER_H
+
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <endian.h>
+
+#include <string>
+
+#include <vpk/file_io.h>
+#include <vpk/io_error.h>
+
+namespace Vpk {
+	// reads little endian values and strings from a memory buffer
+	// (e.g. a Vpk::MappedFile) with the same interface as Vpk::FileIO
+	//
+	// all read operations throw Vpk::IOError(EOF) when reading past the
+	// end of the buffer
+	class BufferReader {
+	public:
+		BufferReader(const char *data, size_t size) :
+			m_begin(data), m_ptr(data), m_end(data + size) {}
+
+		const char *data() const { return m_ptr; }
+		size_t size() const { return m_end - m_begin; }
+		size_t left() const { return m_end - m_ptr; }
+		off_t  tell() const { return m_ptr - m_begin; }
+		bool   eof()  const { return m_ptr == m_end; }
+
+		void seek(off_t offset, FileIO::Whence whence);
+		void seek(off_t offset) { seek(offset, FileIO::CUR); }
+
+		// returns a pointer into the buffer and advances past size bytes
+		const char *skip(size_t size) {
+			need(size);
+			const char *ptr = m_ptr;
+			m_ptr += size;
+			return ptr;
+		}
+
+		void read(char *buf, size_t size) { memcpy(buf, skip(size), size); }
+
+		uint16_t readLU16() { return loadLU16(skip(2)); }
+		uint32_t readLU32() { return loadLU32(skip(4)); }
+
+		// returns a pointer to the zero terminated string in the buffer
+		// and stores its length (without the terminator) in length
+		const char *readAsciiZ(size_t &length) {
+			const char *str = m_ptr;
+			const char *nul = (const char*) memchr(str, 0, m_end - str);
+			if (!nul) throw IOError(EOF);
+			length = nul - str;
+			m_ptr = nul + 1;
+			return str;
+		}
+
+		void readAsciiZ(std::string &s) {
+			size_t length = 0;
+			const char *str = readAsciiZ(length);
+			s.append(str, length);
+		}
+
+		static uint16_t loadLU16(const char *ptr) {
+			uint16_t value;
+			memcpy(&value, ptr, sizeof(value));
+			return le16toh(value);
+		}
+
+		static uint32_t loadLU32(const char *ptr) {
+			uint32_t value;
+			memcpy(&value, ptr, sizeof(value));
+			return le32toh(value);
+		}
+
+	private:
+		void need(size_t size) const {
+			if ((size_t)(m_end - m_ptr) < size) throw IOError(EOF);
+		}
+
+		const char *m_begin;
+		const char *m_ptr;
+		const char *m_end;
+	};
+}
+
+#endif
@@ -19,9 +19,8 @@
 #ifndef VPK_CHECKING_DATA_HANDLER_H
 #define VPK_CHECKING_DATA_HANDLER_H
 
-#include <boost/crc.hpp>
-
 #include <vpk/data_handler.h>
+#include <vpk/crc32.h>
 
 namespace Vpk {
 	class CheckingDataHandler : public DataHandler {
@@ -30,13 +29,18 @@ namespace Vpk {
 			DataHandler(path, crc32) {}
 
 		void process(const char *buffer, size_t length) {
-			m_hash.process_bytes(buffer, length);
+			m_hash.process(buffer, length);
 		}
 
 		void finish();
+
+		// checks a whole file at once, throws like finish()
+		static void check(const DataEntry &entry);
+		// throws like finish() if sum is not expected
+		static void verify(uint32_t expected, uint32_t sum);
 	
 	private:
-		boost::crc_32_type m_hash;
+		Crc32 m_hash;
 	};
 }
 
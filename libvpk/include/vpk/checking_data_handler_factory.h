@@ -28,6 +28,20 @@ namespace Vpk {
 		CheckingDataHandler *create(const std::string &path, uint32_t crc32) {
 			return new CheckingDataHandler(path, crc32);
 		}
+
+		bool batches() const { return true; }
+		bool checksOnly() const { return true; }
+
+		void process(std::vector<DataEntry> &entries) {
+			for (std::vector<DataEntry>::iterator entry = entries.begin(); entry != entries.end(); ++ entry) {
+				try {
+					CheckingDataHandler::check(*entry);
+				}
+				catch (const std::exception &exc) {
+					entry->error = exc.what();
+				}
+			}
+		}
 	};
 }
 
@@ -34,7 +34,8 @@ namespace Vpk {
 			m_begun(false), m_extracting(false), m_raise(raise),
 			m_filecount(0), m_success(0), m_fail(0) {}
 
-		void begin(const Package &package);
+		void begin(const Package &package) { begin(package, package.filecount()); }
+		void begin(const Package &package, size_t count);
 		void end();
 		
 		bool direrror(const std::exception &exc, const std::string &path);
@@ -43,6 +44,7 @@ namespace Vpk {
 		bool filtererror(const std::exception &exc, const std::string &path);
 		void extract(const std::string &filepath);
 		void success(const std::string &filepath);
+		void stage(const char *name, double busy, double total);
 	
 		void setRaise(bool raise) { m_raise = raise; }
 
@@ -0,0 +1,69 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_CRC32_H
+#define VPK_CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Vpk {
+	// CRC-32 (IEEE 802.3) as used by the file checksums, same as
+	// boost::crc_32_type and zlib's crc32().
+	//
+	// There is a portable slicing-by-16 kernel and on x86 kernels that
+	// fold 16 or 64 bytes at a time with carry-less multiplication. By
+	// default the fastest one the CPU supports is used.
+	class Crc32 {
+	public:
+		enum Kernel {
+			SLICING_BY_16,
+			PCLMUL,  // PCLMULQDQ and SSE 4.1
+			VPCLMUL  // VPCLMULQDQ and AVX-512
+		};
+
+		static bool supported(Kernel kernel);
+		static Kernel best();
+		static const char *name(Kernel kernel);
+
+		Crc32() : m_state(0xFFFFFFFF), m_update(update(best())) {}
+
+		// throws Vpk::Exception if the kernel is not supported
+		explicit Crc32(Kernel kernel);
+
+		void reset() { m_state = 0xFFFFFFFF; }
+		void process(const char *buffer, size_t length) { m_state = m_update(m_state, buffer, length); }
+
+		// the checksum of everything processed so far
+		uint32_t checksum() const { return ~m_state; }
+
+		// The checksum of data A followed by data B from the checksums of
+		// A and B and the length of B, so ranges can be hashed apart.
+		static uint32_t combine(uint32_t crcA, uint32_t crcB, uint64_t lengthB);
+
+	private:
+		typedef uint32_t (*Update)(uint32_t state, const char *buffer, size_t length);
+
+		static Update update(Kernel kernel);
+
+		uint32_t m_state;
+		Update   m_update;
+	};
+}
+
+#endif
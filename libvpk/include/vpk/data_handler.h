@@ -20,6 +20,7 @@
 #define VPK_DATA_HANDLER_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include <string>
 
@@ -33,6 +34,16 @@ namespace Vpk {
 
 		virtual void process(const char *buffer, size_t length) = 0;
 		virtual void finish() = 0;
+
+		// Copies up to length bytes at offset of the file fd without
+		// passing them to process(), e.g. in the kernel. Returns how many
+		// bytes were copied, the rest is passed to process(). Handlers
+		// that need to see the data copy nothing.
+		virtual size_t copy(int, uint64_t, size_t) { return 0; }
+
+		// Called before any data with the size of the whole file
+		// (preload data included).
+		virtual void reserve(uint64_t) {}
 	
 		const std::string &path()  const { return m_path; }
 		      uint32_t     crc32() const { return m_crc32; }
@@ -41,6 +52,19 @@ namespace Vpk {
 		std::string m_path;
 		uint32_t    m_crc32;
 	};
+
+	// A small file handed to DataHandlerFactory::process() as a whole:
+	// its preload data followed by its data from the archive. Handling
+	// it failed if error is set.
+	struct DataEntry {
+		const std::string *path;
+		uint32_t           crc32;
+		const char        *preload;
+		size_t             preloadSize;
+		const char        *data;
+		size_t             size;
+		std::string        error;
+	};
 }
 
 #endif
@@ -22,6 +22,10 @@
 #include <stdint.h>
 
 #include <string>
+#include <vector>
+#include <exception>
+
+#include <boost/scoped_ptr.hpp>
 
 #include <vpk/data_handler.h>
 
@@ -37,6 +41,32 @@ namespace Vpk {
 		}
 
 		virtual DataHandler *create(const std::string &path, uint32_t crc32) = 0;
+
+		// Factories that handle small files without a data handler each
+		// return true. Package::process() then passes such files in
+		// batches to process(), which unlike create() is called by
+		// several workers at once.
+		virtual bool batches() const { return false; }
+
+		// Factories whose handlers do nothing but check the CRC32 return
+		// true. Package::process() then hashes pieces of big files on
+		// several workers and combines the checksums, without handlers.
+		virtual bool checksOnly() const { return false; }
+
+		virtual void process(std::vector<DataEntry> &entries) {
+			for (std::vector<DataEntry>::iterator entry = entries.begin(); entry != entries.end(); ++ entry) {
+				try {
+					boost::scoped_ptr<DataHandler> handler(create(*entry->path, entry->crc32));
+					handler->reserve(entry->preloadSize + entry->size);
+					if (entry->preloadSize > 0) handler->process(entry->preload, entry->preloadSize);
+					if (entry->size > 0) handler->process(entry->data, entry->size);
+					handler->finish();
+				}
+				catch (const std::exception &exc) {
+					entry->error = exc.what();
+				}
+			}
+		}
 	};
 }
 
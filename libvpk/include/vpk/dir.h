@@ -21,42 +21,70 @@
 
 #include <string>
 #include <vector>
+#include <atomic>
 
 #include <vpk/node.h>
-#include <vpk/file_io.h>
+#include <vpk/index.h>
 
 namespace Vpk {
 	class File;
 
+	// Directories are filled by their package from its Vpk::Index, the
+	// Dir::read() of version 0.1.0 is gone.
 	class Dir : public Node {
 	public:
 		typedef Nodes::iterator iterator;
 		typedef Nodes::const_iterator const_iterator;
 
-		Dir(const std::string &name) : Node(name), m_subdirs(0) {}
+		// Materializes the children of a lazily loaded directory and then
+		// calls dir.setLoader(0). Until then other threads that access the
+		// directory call load() too, so it has to be thread safe.
+		class Loader {
+		public:
+			virtual ~Loader() {}
+			virtual void load(Dir &dir) = 0;
+		};
+
+		Dir(const char *name, Index::Id id = Index::ROOT) :
+			Node(name), m_id(id), m_subdirs(0), m_loader(0) {}
 
 		Type type() const { return Node::DIR; }
-		void read(FileIO &io, const std::string &path, const std::string &type, std::vector<File*> &dirfiles);
-
-		const Nodes &nodes() const { return m_nodes; }
-		const Node *node(const std::string &name) const;
-		      Node *node(const std::string &name);
-		void add(Node *node);
-		void remove(const std::string &name);
-
-		iterator begin() { return m_nodes.begin(); }
-		iterator end()   { return m_nodes.end(); }
-		const_iterator begin() const { return m_nodes.begin(); }
-		const_iterator end()   const { return m_nodes.end(); }
-		bool empty() const { return m_nodes.empty(); }
+		Index::Id id() const { return m_id; }
+
+		// every accessor of the children loads them first
+		void setLoader(Loader *loader) { m_loader.store(loader, std::memory_order_release); }
+		bool loaded() const { return m_loader.load(std::memory_order_acquire) == 0; }
+		void load() const;
+
+		const Nodes &nodes() const { load(); return m_nodes; }
+		const Node *node(const char *name) const;
+		      Node *node(const char *name);
+		const Node *node(const std::string &name) const { return node(name.c_str()); }
+		      Node *node(const std::string &name)       { return node(name.c_str()); }
+
+		// nodes are not owned by their directory, returns the node of
+		// the same name that was replaced, if any (it returned nothing
+		// up to version 0.1.0)
+		Node *add(Node *node);
+		void remove(const char *name);
+		void remove(const std::string &name) { remove(name.c_str()); }
+		void clear();
+
+		iterator begin() { load(); return m_nodes.begin(); }
+		iterator end()   { load(); return m_nodes.end(); }
+		const_iterator begin() const { load(); return m_nodes.begin(); }
+		const_iterator end()   const { load(); return m_nodes.end(); }
+		bool empty() const { load(); return m_nodes.empty(); }
 	
 		// only used by vpkfs so it can give a UNIX-like
 		// hardlink count so find works:
 		size_t subdirs() const { return m_subdirs; }
 
 	private:
-		Nodes  m_nodes;
-		size_t m_subdirs;
+		Nodes     m_nodes;
+		Index::Id m_id;
+		size_t    m_subdirs;
+		std::atomic<Loader*> m_loader;
 	};
 }
 
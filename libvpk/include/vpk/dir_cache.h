@@ -0,0 +1,81 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_DIR_CACHE_H
+#define VPK_DIR_CACHE_H
+
+#include <stddef.h>
+
+#include <list>
+#include <string>
+#include <utility>
+
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/filesystem/path.hpp>
+
+namespace Vpk {
+	// Creates directories below a destination directory once and keeps
+	// the descriptors of the capacity() most recently created ones open,
+	// so files are created with openat() relative to their parent instead
+	// of resolving the whole path each time. Files in directories that
+	// are not cached anymore are opened relative to the destination
+	// directory. Paths are relative to it and use '/' as separator.
+	//
+	// Not thread safe. root(), dir() and create() may throw Vpk::IOError.
+	class DirCache : private boost::noncopyable {
+	public:
+		DirCache(const boost::filesystem::path &root, size_t capacity = 256) :
+			m_root(root), m_rootFd(-1), m_capacity(capacity > 0 ? capacity : 1) {}
+		~DirCache() { clear(); }
+
+		// descriptor of the destination directory, created if needed
+		int root();
+
+		// creates the directory and its parents unless that was done
+		// before, returns its descriptor, which stays valid until the
+		// next call of dir() or create()
+		int dir(const std::string &path);
+
+		// whether dir(path) was called before
+		bool created(const std::string &path) const { return path.empty() ? m_rootFd >= 0 : m_created.find(path) != m_created.end(); }
+
+		// creates or truncates a file, returns its descriptor
+		int create(const std::string &path);
+
+		// flushes the whole file system the destination directory is on
+		void sync();
+
+		const boost::filesystem::path &path() const { return m_root; }
+		size_t capacity() const { return m_capacity; }
+		void clear();
+
+	private:
+		typedef std::list< std::pair<std::string, int> > Lru;
+
+		boost::filesystem::path m_root;
+		int                     m_rootFd;
+		size_t                  m_capacity;
+		Lru                     m_lru;
+		boost::unordered_map<std::string, Lru::iterator> m_fds;
+		boost::unordered_set<std::string> m_created;
+	};
+}
+
+#endif
@@ -21,38 +21,37 @@
 
 #include <stdint.h>
 
-#include <string>
-#include <vector>
-
 #include <vpk/node.h>
-#include <vpk/file_io.h>
+#include <vpk/index.h>
 
 namespace Vpk {
+	// View of a file entry of a Vpk::Index. The public fields crc32,
+	// size, offset, index and preload of version 0.1.0 are accessors of
+	// the same names now, e.g. file.crc32 becomes file.crc32(). The
+	// preload data is preload() with a length of preloadSize() instead
+	// of a std::vector<char>. File::read() is gone, Vpk::Index reads the
+	// file records.
 	class File : public Node {
 	public:
-		File(const std::string &name,
-		     uint32_t crc32 = 0,
-			 uint32_t size = 0,
-			 uint32_t offset = 0,
-			 uint16_t index = 0) :
-			Node(name),
-			crc32(crc32),
-			size(size),
-			offset(offset),
-			index(index),
-			preload(0, 0) {}
+		File(const char *name, const Index &index, Index::Id id) :
+			Node(name), m_index(&index), m_id(id) {}
 
 		Type type() const { return Node::FILE; }
-		void read(FileIO &io, std::vector<File*> &dirfiles);
 
-		uint32_t crc32;
-		uint32_t size;
-		uint32_t offset;
-		uint16_t index;
-		std::vector<char> preload;
+		Index::Id   id()          const { return m_id; }
+		uint32_t    crc32()       const { return m_index->crc32(m_id); }
+		uint32_t    size()        const { return m_index->size(m_id); }
+		uint32_t    offset()      const { return m_index->offset(m_id); }
+		uint16_t    index()       const { return m_index->archive(m_id); }
+		size_t      preloadSize() const { return m_index->preloadSize(m_id); }
+		const char *preload()     const { return m_index->preload(m_id); }
+
+	private:
+		const Index *m_index;
+		Index::Id    m_id;
 	};
 
-	typedef boost::shared_ptr<File> FilePtr;
+	typedef File *FilePtr;
 }
 
 #endif
@@ -19,9 +19,8 @@
 #ifndef VPK_FILE_DATA_HANDLER_H
 #define VPK_FILE_DATA_HANDLER_H
 
-#include <boost/crc.hpp>
-
 #include <vpk/checking_data_handler.h>
+#include <vpk/dir_cache.h>
 #include <vpk/file_io.h>
 
 namespace Vpk {
@@ -29,11 +28,33 @@ namespace Vpk {
 	public:
 		typedef CheckingDataHandler super_type;
 
-		FileDataHandler(const boost::filesystem::path &path, uint32_t crc32, bool check);
+		// With sync set the file system is going to be synced after
+		// extracting, so writing back to disk is started early.
+		FileDataHandler(const boost::filesystem::path &path, uint32_t crc32, bool check, bool sync = false);
+		// path is relative to the root of dirs
+		FileDataHandler(DirCache &dirs, const std::string &path, uint32_t crc32, bool check, bool sync = false);
+
+		// Files are written unbuffered, so writes are as big as the data
+		// passed in. Big files are preallocated and with sync every
+		// WRITE_BEHIND bytes written are handed to the disk.
+		static const uint64_t RESERVE_SIZE = 1024 * 1024;
+		static const uint64_t WRITE_BEHIND = 8 * 1024 * 1024;
+
+		void reserve(uint64_t size) {
+			if (size >= RESERVE_SIZE) m_io.reserve(size);
+		}
 
 		void process(const char *buffer, size_t length) {
 			if (m_check) super_type::process(buffer, length);
 			m_io.write(buffer, length);
+			written(length);
+		}
+
+		// without checking the data is copied in the kernel if possible
+		size_t copy(int fd, uint64_t offset, size_t length) {
+			size_t count = m_check ? 0 : m_io.writeFrom(fd, offset, length);
+			written(count);
+			return count;
 		}
 
 		void finish() {
@@ -41,11 +62,24 @@ namespace Vpk {
 			if (m_check) super_type::finish();
 		}
 
+		// writes a whole file to fd with a single writev() and closes fd
+		static void write(int fd, const DataEntry &entry);
+
 		bool check() const { return m_check; }
+		bool sync() const { return m_sync; }
 	
 	private:
-		bool   m_check;
-		FileIO m_io;
+		void written(size_t count) {
+			m_written += count;
+			if (m_sync && m_written - m_started >= WRITE_BEHIND) writeBehind();
+		}
+		void writeBehind();
+
+		bool     m_check;
+		bool     m_sync;
+		FileIO   m_io;
+		uint64_t m_written;
+		uint64_t m_started; // writing back [0, m_started) was started
 	};
 }
 
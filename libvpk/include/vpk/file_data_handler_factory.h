@@ -19,29 +19,44 @@
 #ifndef VPK_FILE_DATA_HANDLER_FACTORY_H
 #define VPK_FILE_DATA_HANDLER_FACTORY_H
 
+#include <mutex>
+
 #include <vpk/file_data_handler.h>
 #include <vpk/data_handler_factory.h>
 
 namespace Vpk {
 	class FileDataHandlerFactory : public DataHandlerFactory {
 	public:
-		FileDataHandlerFactory(const std::string &destdir, bool check)
-		: m_destdir(destdir), m_check(check) {}
+		FileDataHandlerFactory(const std::string &destdir, bool check, bool sync = false)
+		: m_destdir(destdir), m_check(check), m_sync(sync), m_dirs(destdir) {}
 
+		// files are created relative to cached directory descriptors
 		FileDataHandler *create(const boost::filesystem::path &path, uint32_t crc32) {
-			return new FileDataHandler(m_destdir / path, crc32, m_check);
+			return create(path.string(), crc32);
 		}
 
 		FileDataHandler *create(const std::string &path, uint32_t crc32) {
-			return new FileDataHandler(m_destdir / path, crc32, m_check);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return new FileDataHandler(m_dirs, path, crc32, m_check, m_sync);
 		}
 
+		// small files are written with one writev() each
+		bool batches() const { return true; }
+		void process(std::vector<DataEntry> &entries);
+
+		// makes everything written so far durable
+		void sync() { m_dirs.sync(); }
+
 		const boost::filesystem::path &destdir() const { return m_destdir; }
 		bool check() const { return m_check; }
+		bool syncing() const { return m_sync; }
 	
 	private:
 		boost::filesystem::path m_destdir;
 		bool                    m_check;
+		bool                    m_sync;
+		DirCache                m_dirs;
+		std::mutex              m_mutex; // guards m_dirs
 	};
 }
 
@@ -118,6 +118,22 @@ namespace Vpk {
 		size_t   readSome(char *buf, size_t size);
 		size_t   readSome(FileIO &dest, size_t size);
 
+		// Copies size bytes at offset of the file fd to the current
+		// position in the kernel (splice() into pipes, otherwise
+		// copy_file_range(), then sendfile()). Returns how many bytes were
+		// copied, which is less on EOF or if none is supported for these
+		// files.
+		size_t   writeFrom(int fd, off_t offset, size_t size);
+
+		// Preallocates size bytes without changing the file size, if the
+		// file system supports it.
+		void     reserve(uint64_t size);
+		static void reserve(int fd, uint64_t size);
+
+		// Starts writing [offset, offset + size) back to disk and with
+		// wait also waits for that. Does nothing where not supported.
+		void     syncRange(off_t offset, off_t size, bool wait);
+
 		// throws Vpk::IOError when EOF before size is read
 		void     read(char *buf, size_t size);
 		void     read(FileIO &dest, size_t size);
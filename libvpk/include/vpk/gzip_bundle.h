@@ -0,0 +1,132 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_GZIP_BUNDLE_H
+#define VPK_GZIP_BUNDLE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <vpk/file_io.h>
+#include <vpk/tar_writer.h>
+
+namespace Vpk {
+	// A gzip compressed tar stream, e.g. for Vpk::TarDataHandlerFactory.
+	// The stream is cut into blocks that are compressed by a pool of
+	// threads as independent gzip members, so gunzip and tar read it as
+	// usual. The index file (path + ".idx") lists where each block and
+	// the data of each file starts:
+	//
+	//   vpk-bundle-index 1
+	//   block COMPRESSED-OFFSET UNCOMPRESSED-OFFSET
+	//   file UNCOMPRESSED-OFFSET SIZE PATH
+	//
+	// so single files can be read by inflating only their blocks (see
+	// Vpk::GzipBundleReader). Not thread safe.
+	class GzipBundle : public TarWriter::Output, private boost::noncopyable {
+	public:
+		static const size_t BLOCK_SIZE = 1024 * 1024;
+
+		// level is a zlib compression level
+		GzipBundle(const boost::filesystem::path &path, unsigned int threads, int level = -1, size_t blockSize = BLOCK_SIZE);
+		~GzipBundle();
+
+		void write(const char *buffer, size_t length);
+		void entry(const std::string &path, uint64_t offset, uint64_t size);
+		// compresses and writes what is left, then the index is complete
+		void finish();
+
+		unsigned int threads() const { return m_workers.size(); }
+		size_t blockSize() const { return m_blockSize; }
+
+	private:
+		struct Block {
+			Block(uint64_t offset) : offset(offset), done(false) {}
+
+			uint64_t          offset; // uncompressed
+			std::vector<char> data;
+			std::vector<char> compressed;
+			std::string       error;
+			bool              done;
+		};
+
+		void work();
+		void submit();
+		void flush(bool all);
+		void stop();
+
+		FileIO   m_io;
+		FileIO   m_index;
+		int      m_level;
+		size_t   m_blockSize;
+		uint64_t m_offset;   // uncompressed offset of the current block
+		uint64_t m_written;  // compressed bytes written
+		boost::shared_ptr<Block> m_block;
+
+		std::mutex              m_mutex;
+		std::condition_variable m_ready; // blocks to compress
+		std::condition_variable m_done;  // compressed blocks
+		std::deque< boost::shared_ptr<Block> > m_pending; // in stream order
+		std::deque< boost::shared_ptr<Block> > m_queue;   // not started yet
+		std::vector<std::thread> m_workers;
+		bool     m_stop;
+	};
+
+	// reads single files of a Vpk::GzipBundle using its index
+	class GzipBundleReader : private boost::noncopyable {
+	public:
+		GzipBundleReader(const boost::filesystem::path &path);
+
+		bool has(const std::string &path) const { return m_files.find(path) != m_files.end(); }
+		uint64_t size(const std::string &path) const;
+		void read(const std::string &path, std::vector<char> &data);
+		void read(const std::string &path, FileIO &out);
+
+	private:
+		struct Entry {
+			uint64_t offset;
+			uint64_t size;
+		};
+
+		struct BlockEntry {
+			uint64_t compressed;
+			uint64_t offset;
+
+			bool operator < (const BlockEntry &other) const { return offset < other.offset; }
+		};
+
+		const Entry &find(const std::string &path) const;
+		template<typename Sink> void inflate(const Entry &entry, Sink &sink);
+
+		FileIO m_io;
+		std::vector<BlockEntry> m_blocks;
+		boost::unordered_map<std::string, Entry> m_files;
+	};
+}
+
+#endif
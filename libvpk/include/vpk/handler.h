@@ -19,6 +19,8 @@
 #ifndef VPK_HANDLER_H
 #define VPK_HANDLER_H
 
+#include <stddef.h>
+
 #include <exception>
 
 namespace Vpk {
@@ -29,6 +31,8 @@ namespace Vpk {
 		virtual ~Handler() {}
 
 		virtual void begin(const Package &package) = 0;
+		// like begin(package), but for count items that are not files
+		virtual void begin(const Package &package, size_t) { begin(package); }
 		virtual void end() = 0;
 
 		virtual bool filtererror(const std::exception &exc, const std::string &path) = 0;
@@ -37,6 +41,11 @@ namespace Vpk {
 		virtual bool archiveerror(const std::exception &exc, const std::string &path) = 0;
 		virtual void extract(const std::string &filepath) = 0;
 		virtual void success(const std::string &filepath) = 0;
+
+		// Before end() of a pipelined run: for how many of its total
+		// seconds the named stage was busy, i.e. neither waiting for the
+		// other stages nor done.
+		virtual void stage(const char*, double, double) {}
 	};
 }
 
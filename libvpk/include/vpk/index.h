@@ -0,0 +1,280 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_INDEX_H
+#define VPK_INDEX_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+namespace Vpk {
+	class FileIO;
+	class BufferReader;
+
+	// Flat struct-of-arrays representation of the package index.
+	//
+	// Files and directories are addressed by 32bit ids. Every path
+	// component is a directory of its own, directory 0 is the root and
+	// parents always have lower ids than their children, so a single
+	// pass in id order visits parents first.
+	//
+	// All strings live in one pool. File names are stored once with
+	// their type (extension) appended, so file nodes can point at them
+	// (see Vpk::Package). Type names are interned once per package.
+	//
+	// Preload bytes read through a Vpk::BufferReader are not copied. They
+	// are referenced by their offset in the reader's buffer, which has to
+	// outlive the index (see Vpk::Package, which keeps the mapping of the
+	// directory file).
+	//
+	// Blocks of file records can also be deferred: only their position
+	// in the buffer is recorded and the records of a directory are added
+	// the first time it is loaded. files() only counts loaded records.
+	//
+	// A complete index can be saved as a flat dump of its arrays and
+	// restored from a buffer (e.g. a mapped cache file) without parsing.
+	//
+	// All loaded files and all directories are in an open addressing
+	// hash table keyed by their full path, optionally folded to lower
+	// case. Lookups do not allocate.
+	class Index {
+	public:
+		typedef uint32_t Id;
+
+		static const Id       ROOT        = 0;
+		static const uint16_t DIR_ARCHIVE = 0x7fff;
+		static const size_t   RECORD_SIZE = 18;
+
+		Index() : m_icase(false), m_view(0), m_viewSize(0) { clear(); }
+
+		// clears everything but the lookup mode
+		void clear();
+
+		// In case insensitive mode ASCII letters are folded to lower case
+		// when looking up paths. Of files or directories whose paths only
+		// differ in case the first one is found. Switching the mode
+		// rehashes everything.
+		void setIcase(bool icase);
+		bool icase() const { return m_icase; }
+
+		size_t files()   const { return m_crc32.size(); }
+		size_t dirs()    const { return m_dirName.size(); }
+		size_t records() const { return m_crc32.size() + m_deferred; }
+
+		// ids of all archives referenced by loaded or deferred records
+		void archives(std::vector<uint16_t> &ids) const;
+
+		uint32_t    crc32(Id file)       const { return m_crc32[file]; }
+		uint32_t    size(Id file)        const { return m_size[file]; }
+		uint32_t    offset(Id file)      const { return m_offset[file]; }
+		uint16_t    archive(Id file)     const { return m_archive[file]; }
+		Id          parent(Id file)      const { return m_parent[file]; }
+		const char *name(Id file)        const { return &m_strings[m_name[file]]; }
+		const char *type(Id file)        const { return &m_strings[m_typeName[m_type[file]]]; }
+		uint16_t    preloadSize(Id file) const { return m_preloadSize[file]; }
+		const char *preload(Id file)     const { return (m_view ? m_view : m_preloads.data()) + m_preload[file]; }
+
+		const char *dirName(Id dir)   const { return &m_strings[m_dirName[dir]]; }
+		Id          dirParent(Id dir) const { return m_dirParent[dir]; }
+
+		std::string path(Id file) const;
+		std::string dirPath(Id dir) const;
+
+		// paths of all directories, indexed by directory id
+		void dirPaths(std::vector<std::string> &paths) const;
+
+		Id mkdir(const char *path);
+		Id mkdir(const std::string &path) { return mkdir(path.c_str()); }
+
+		// An entry is a file id or a directory id with DIR_ENTRY set.
+		typedef uint32_t Entry;
+
+		static const Entry NOT_FOUND = 0xFFFFFFFF;
+		static const Entry DIR_ENTRY = 0x80000000;
+
+		static bool isDir(Entry entry)   { return (entry & DIR_ENTRY) != 0; }
+		static Id   entryId(Entry entry) { return entry & ~DIR_ENTRY; }
+
+		// path has to be normalized: components separated by single
+		// slashes, no leading or trailing slash. The empty path is the
+		// root directory. Of duplicate files the last one is found.
+		Entry find(const char *path, size_t length) const;
+		Entry find(const std::string &path) const { return find(path.c_str(), path.size()); }
+
+		// a directory at path with deferred records, NOT_FOUND if there
+		// is none left
+		Id findPending(const char *path, size_t length) const;
+
+		// read the file records of one directory block
+		void read(FileIO &io, Id dir, const std::string &type);
+		void read(BufferReader &reader, Id dir, const std::string &type);
+
+		// skip over the file records of one directory block and remember
+		// where they are. A stream cannot be revisited, so it is read
+		// right away.
+		void defer(FileIO &io, Id dir, const std::string &type) { read(io, dir, type); }
+		void defer(BufferReader &reader, Id dir, const std::string &type);
+
+		bool pending() const { return m_deferred > 0; }
+		bool pending(Id dir) const { return m_dirBlock[dir] != NO_BLOCK; }
+
+		// add the deferred file records of a directory
+		void load(Id dir);
+
+		// Makes room for all deferred records, so loading them later
+		// moves neither the string pool nor the file arrays. Nodes point
+		// into the pool and threads may read loaded files meanwhile.
+		void reserve();
+
+		// add the deferred file records of all directories in directory
+		// order. Up to threads workers decode disjoint ranges of blocks
+		// straight into the arrays, so the result does not depend on the
+		// number of threads. If nothing was loaded before the index ends
+		// up grouped.
+		void loadAll(unsigned int threads = 1);
+
+		// Sort files by their directory so that the files of a
+		// directory are the range [firstFile(dir), lastFile(dir)).
+		// The grouping is kept by retain() and restore().
+		void group();
+		bool grouped() const { return !m_dirFirst.empty(); }
+		Id firstFile(Id dir) const { return m_dirFirst[dir]; }
+		Id lastFile(Id dir)  const { return m_dirFirst[dir + 1]; }
+
+		// save() groups the index and writes it in host byte order.
+		// Only an index without deferred records whose preload data is
+		// referenced (not copied) can be saved. restore() throws
+		// Vpk::FileFormatError if the data is inconsistent and
+		// references the preload data in view.
+		void save(FileIO &io);
+		void restore(BufferReader &reader, const char *view, size_t viewSize);
+
+		// make offsets of files stored in the directory file absolute
+		void relocate(uint32_t dataOffset);
+
+		// drop every file that is not kept and every directory that is
+		// neither kept itself, nor inside of a kept directory, nor
+		// containing something kept. Deferred records are dropped too.
+		void retain(const std::vector<bool> &keepFiles, const std::vector<bool> &keepDirs);
+
+		// marks the files that are replaced by a later file of the same
+		// path (only the last one is in the hash table), returns whether
+		// there are any
+		bool shadowed(std::vector<bool> &files) const;
+
+	private:
+		struct Block {
+			uint32_t offset;
+			uint32_t records;
+			uint32_t bytes;   // of the names once loaded
+			uint32_t next;
+			uint16_t type;
+		};
+
+		static const uint32_t NO_BLOCK = 0xFFFFFFFF;
+
+		// a deferred block and the id of its first file once loaded
+		struct Pending {
+			uint32_t block;
+			Id       dir;
+			Id       file;
+		};
+
+		// the hash code is kept in the table so probing does not need
+		// to touch the entries themselves
+		struct Slot {
+			uint32_t code;
+			Entry    entry;
+		};
+
+		typedef boost::unordered_map<std::string,uint32_t> Strings;
+
+		Id mkdir(Id parent, const char *name, size_t length);
+		Id add(Id dir, const char *name, size_t length, uint16_t type, const char *record);
+		void decode(const std::vector<Pending> &pending, size_t begin, size_t end, std::vector<char> &strings);
+		void readBlock(BufferReader &reader, Id dir, uint16_t type);
+		void relocate(Id first, Id last);
+		uint16_t addType(const std::string &type);
+		uint32_t store(const char *str, size_t length);
+		// appends stem.type
+		void appendName(std::vector<char> &strings, const char *stem, size_t length, uint16_t type) const;
+		uint32_t intern(const char *str, size_t length);
+
+		// FNV-1a, the state of a directory is continued for its children
+		static uint64_t hash(uint64_t state, const char *str, size_t length);
+		static uint64_t hashLower(uint64_t state, const char *str, size_t length);
+		static bool equalsLower(const char *a, const char *b, size_t length);
+		uint64_t key(uint64_t state, const char *str, size_t length) const {
+			return m_icase ? hashLower(state, str, length) : hash(state, str, length);
+		}
+		bool equals(const char *a, const char *b, size_t length) const {
+			return m_icase ? equalsLower(a, b, length) : memcmp(a, b, length) == 0;
+		}
+		static uint32_t fold(uint64_t state) { return state ^ (state >> 32); }
+		uint64_t childHash(Id dir) const;
+		uint32_t fileHash(Id dir, const char *name, size_t length) const;
+		uint32_t entryHash(Entry entry) const {
+			return isDir(entry) ? fold(m_dirHash[entryId(entry)]) : m_fileHash[entryId(entry)];
+		}
+		bool matches(Entry entry, const char *path, size_t length) const;
+		void insert(Entry entry);
+		void rehash(size_t entries);
+		void rehashAll();
+
+		std::vector<uint32_t> m_crc32;
+		std::vector<uint32_t> m_size;
+		std::vector<uint32_t> m_offset;
+		std::vector<uint16_t> m_archive;
+		std::vector<Id>       m_parent;
+		std::vector<uint32_t> m_name;
+		std::vector<uint16_t> m_type;
+		std::vector<uint16_t> m_preloadSize;
+		std::vector<uint32_t> m_preload;
+
+		std::vector<uint32_t> m_dirName;
+		std::vector<Id>       m_dirParent;
+		std::vector<Id>       m_dirFirst;
+		std::vector<uint64_t> m_dirHash;
+
+		std::vector<uint32_t> m_fileHash;
+		std::vector<Slot>     m_slots;
+
+		std::vector<uint32_t> m_typeName;
+		bool                  m_icase;
+
+		std::vector<char>     m_strings;
+		Strings               m_interned;
+		std::vector<char>     m_preloads;
+		const char           *m_view;
+		size_t                m_viewSize;
+
+		std::vector<Block>    m_blocks;
+		std::vector<uint32_t> m_dirBlock;
+		size_t                m_deferred;
+		size_t                m_deferredBytes;
+		uint32_t              m_dataOffset;
+		std::vector<bool>     m_archives;
+	};
+}
+
+#endif
@@ -0,0 +1,59 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_MAPPED_FILE_H
+#define VPK_MAPPED_FILE_H
+
+#include <stddef.h>
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem/path.hpp>
+
+namespace Vpk {
+	// read-only memory mapping of a whole file
+	//
+	// open may throw Vpk::IOError
+	class MappedFile : private boost::noncopyable {
+	public:
+		MappedFile() : m_data(0), m_size(0) {}
+		MappedFile(const char *filename) : m_data(0), m_size(0) { open(filename); }
+		MappedFile(const std::string &filename) : m_data(0), m_size(0) { open(filename); }
+		MappedFile(const boost::filesystem::path &path) : m_data(0), m_size(0) { open(path); }
+		~MappedFile() { close(); }
+
+		void open(const char *filename);
+		void open(const std::string &filename) { open(filename.c_str()); }
+		void open(const boost::filesystem::path &path) { open(path.string()); }
+		void close();
+
+		// madvise() the whole mapping
+		void advise(int advice);
+
+		bool opened() const { return m_data != 0; }
+		const char *data() const { return m_data; }
+		size_t size() const { return m_size; }
+
+	private:
+		const char *m_data;
+		size_t      m_size;
+	};
+}
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_MD5_H
+#define VPK_MD5_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+namespace Vpk {
+	// MD5 (RFC 1321) as used by the checksums of version 2 packages
+	class Md5 {
+	public:
+		static const size_t DIGEST_SIZE = 16;
+
+		struct Digest {
+			unsigned char bytes[DIGEST_SIZE];
+
+			bool operator == (const Digest &other) const { return memcmp(bytes, other.bytes, DIGEST_SIZE) == 0; }
+			bool operator != (const Digest &other) const { return !(*this == other); }
+
+			// lower case hex string
+			std::string str() const;
+		};
+
+		Md5() { reset(); }
+
+		void reset();
+		void process(const char *buffer, size_t length);
+
+		// the digest of everything processed so far
+		Digest digest() const;
+
+	private:
+		static const size_t BLOCK_SIZE = 64;
+
+		void transform(const unsigned char *blocks, size_t count);
+
+		uint32_t      m_state[4];
+		uint64_t      m_length;
+		unsigned char m_buffer[BLOCK_SIZE];
+	};
+}
+
+#endif
@@ -19,13 +19,29 @@
 #ifndef VPK_NODE_H
 #define VPK_NODE_H
 
+#include <string.h>
+
 #include <iostream>
 #include <string>
 
-#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
 
 namespace Vpk {
+	// Nodes do not own their names, they point into the string pools of
+	// the package they belong to. Nodes themselves are owned by the arena
+	// of their package.
+	//
+	// Up to version 0.1.0 nodes were heap objects owning a std::string
+	// name. Code written against that has to change like this:
+	//  - NodePtr and FilePtr are plain pointers instead of
+	//    boost::shared_ptr. Use them as pointers (no get() or reset())
+	//    and never delete them. They stay valid until the package is
+	//    read again, filtered or destroyed.
+	//  - name() returns a const char* instead of a const std::string&,
+	//    construct a std::string from it where one is needed.
+	//  - The constructors and setName() take a const char* that has to
+	//    outlive the node instead of a std::string.
 	class Node {
 	public:
 		enum Type {
@@ -33,20 +49,32 @@ namespace Vpk {
 			DIR
 		};
 
-		Node(const std::string& name) : m_name(name) {}
+		Node(const char *name) : m_name(name) {}
 		virtual ~Node() {}
 		
 		virtual Type type() const = 0;
 
-		void setName(const std::string &name) { m_name = name; }
-		const std::string &name() const { return m_name; }
+		void setName(const char *name) { m_name = name; }
+		const char *name() const { return m_name; }
 
 	private:
-		std::string m_name;
+		const char *m_name;
+	};
+
+	struct NameHash {
+		size_t operator () (const char *name) const {
+			return boost::hash_range(name, name + strlen(name));
+		}
+	};
+
+	struct NameEqual {
+		bool operator () (const char *lhs, const char *rhs) const {
+			return strcmp(lhs, rhs) == 0;
+		}
 	};
 
-	typedef boost::shared_ptr<Node>                   NodePtr;
-	typedef boost::unordered_map<std::string,NodePtr> Nodes;
+	typedef Node *NodePtr;
+	typedef boost::unordered_map<const char*,NodePtr,NameHash,NameEqual> Nodes;
 }
 
 #endif
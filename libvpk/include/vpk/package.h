@@ -23,23 +23,35 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
 
 #include <boost/unordered_map.hpp>
 #include <boost/filesystem/operations.hpp>
 
 #include <vpk/node.h>
 #include <vpk/dir.h>
+#include <vpk/index.h>
+#include <vpk/arena.h>
 #include <vpk/handler.h>
 #include <vpk/data_handler_factory.h>
 #include <vpk/file_io.h>
+#include <vpk/mapped_file.h>
+#include <vpk/md5.h>
 
 namespace Vpk {
 	class File;
 
-	class Package : public Dir {
+	class Package : public Dir, private Dir::Loader {
 	public:
 		Package(Handler *handler = 0) :
-			Dir(""), m_version(0), m_dataOffset(0), m_footerOffset(0), m_footerSize(0), m_srcdir("."), m_handler(handler) {}
+			Dir(""), m_version(0), m_dataOffset(0), m_footerOffset(0), m_footerSize(0),
+			m_archiveMd5Size(0), m_otherMd5Size(0), m_signatureSize(0), m_hasMd5(false), m_srcdir("."), m_shadowedFiles(0), m_lazy(false), m_archiveOrder(true), m_uring(false), m_pipeline(false), m_sync(false),
+			m_threads(std::max(std::thread::hardware_concurrency(), 1u)), m_deviceThreads(0),
+			m_readSize(4 * 1024 * 1024), m_readGap(64 * 1024), m_handler(handler), m_unloaded(0) {}
+		~Package() { clearTree(); }
 
 		void read(const char *path) { read(boost::filesystem::path(path)); }
 		void read(const std::string &path) { read(boost::filesystem::path(path)); }
@@ -57,28 +69,183 @@ namespace Vpk {
 		unsigned int dataoff() const { return m_dataOffset; }
 		unsigned int footerOffset() const { return m_footerOffset; }
 		unsigned int footerSize() const { return m_footerSize; }
+
+		// The footer of version 2 packages consists of the archive MD5
+		// section, the other MD5 section and the signature section.
+		unsigned int archiveMd5Size() const { return m_archiveMd5Size; }
+		unsigned int otherMd5Size() const { return m_otherMd5Size; }
+		unsigned int signatureSize() const { return m_signatureSize; }
+
+		// MD5 of a range of an archive. Offsets of ranges in the directory
+		// file are relative to dataoff(), like those of files.
+		struct ChunkHash {
+			uint16_t    archive;
+			uint32_t    offset;
+			uint32_t    size;
+			Md5::Digest md5;
+		};
+
+		const std::vector<ChunkHash> &chunkHashes() const { return m_chunkHashes; }
+
+		// MD5 of the index, of the archive MD5 section and of the
+		// directory file up to the whole file MD5 itself
+		bool hasMd5() const { return m_hasMd5; }
+		const Md5::Digest &treeMd5() const { return m_treeMd5; }
+		const Md5::Digest &chunkHashesMd5() const { return m_chunkHashesMd5; }
+		const Md5::Digest &fileMd5() const { return m_fileMd5; }
 		const std::string &srcdir() const { return m_srcdir; }
 		const std::string &dirfile() const { return m_dirfile; }
+		// in lazy mode the index keeps files that are shadowed by a later
+		// duplicate (see shadowed()), a full read drops them
+		const Index &index() const { loadAll(); return m_index; }
+		// paths are looked up in the hash table of the index, case
+		// insensitively if enabled (see Vpk::Index::setIcase)
 		Node *get(const std::string &path) { return get(path.c_str()); }
 		Node *get(const char *path);
+		Node *get(const char *path, size_t length);
+		void setIcase(bool icase) { m_index.setIcase(icase); }
+		bool icase() const { return m_index.icase(); }
 		void setHandler(Handler *handler) { m_handler = handler; }
 		const Handler *handler() const { return m_handler; }
 
+		// In lazy mode read() only records where the file records of each
+		// directory are and a directory's files are added the first time
+		// it is accessed. Whole walks (index(), filter(), process(), ...)
+		// load everything that is still missing.
+		//
+		// Directories may be loaded by get() and by accessing them from
+		// several threads at once (like vpkfs does), loading is
+		// serialized by a lock. Once everything is loaded get() takes no
+		// lock anymore. Whole walks and filter() must not run
+		// concurrently with anything else.
+		void setLazy(bool lazy) { m_lazy = lazy; }
+		bool lazy() const { return m_lazy; }
+		using Dir::load;
+		void loadAll() const;
+
+		// number of threads used to decode the index of a mapped
+		// directory file, to verify MD5 sums and to extract or check
+		// files, defaults to the number of cores
+		void setThreads(unsigned int threads) { m_threads = threads > 0 ? threads : 1; }
+		unsigned int threads() const { return m_threads; }
+
+		// If a cache directory is set read() loads the index from a
+		// cache file written by an earlier read() of the same, unchanged
+		// directory file instead of parsing it. Files in the tree are
+		// then always added lazily per directory.
+		void setCacheDir(const std::string &dir) { m_cacheDir = dir; }
+		const std::string &cacheDir() const { return m_cacheDir; }
+		boost::filesystem::path cachePath() const;
+
+		// drops everything not below paths and rebuilds the tree, so it
+		// invalidates all nodes handed out before
 		void filter(const std::vector<std::string> &paths);
 		void extract(const std::string &destdir, bool check = false) const;
 		void check() const;
+
+		// Writes the data of file to out: the preload data, then the
+		// archive data copied in the kernel if possible (see
+		// FileIO::writeFrom). Archives are opened as needed and kept in
+		// archives for further calls.
+		typedef boost::unordered_map< uint16_t, boost::shared_ptr<FileIO> > Archives;
+		void copy(const File &file, FileIO &out, Archives &archives) const;
+
+		// checks all MD5 sums of the footer, reported to the handler
+		// like files
+		void verifyMd5() const;
+
+		// Files are handled by a pool of threads() workers, each
+		// reading with its own archive handles. Data handlers run on the
+		// workers, so only factory.create() is serialized. The handler
+		// is only called from the calling thread, in schedule() order.
 		void process(DataHandlerFactory &factory) const;
 
-		size_t filecount() const;
+		// By default process() (and so extract() and check()) handles
+		// files sorted by archive and offset, so each archive is read
+		// front to back. Otherwise files are handled in index order.
+		void setArchiveOrder(bool archiveOrder) { m_archiveOrder = archiveOrder; }
+		bool archiveOrder() const { return m_archiveOrder; }
 
-		typedef boost::unordered_map< uint16_t, boost::shared_ptr<FileIO> > Archives;
+		// process() reads runs of consecutive files of one archive that
+		// are at most readGap() bytes apart with single reads of up to
+		// readSize() bytes (per worker) and skips the gaps. Bigger files
+		// are read in pieces of readSize().
+		void setReadSize(size_t size) { m_readSize = size > 0 ? size : 1; }
+		size_t readSize() const { return m_readSize; }
+		void setReadGap(size_t gap) { m_readGap = gap; }
+		size_t readGap() const { return m_readGap; }
+
+		// extract() and check() use io_uring instead of the worker pool
+		// if the kernel supports it (see Vpk::Ring). Archive reads and
+		// the opening, writing and closing of extracted files are queued
+		// in the kernel, checksums are computed by the calling thread.
+		void setUring(bool uring) { m_uring = uring; }
+		bool uring() const { return m_uring; }
+
+		// Otherwise extract() and check() can run as a pipeline instead of
+		// the worker pool: one thread reads the archives, one computes the
+		// checksums and the calling thread writes files and reports. The
+		// stages pass pooled read buffers through lock-free queues and how
+		// busy each one was is reported to the handler.
+		void setPipeline(bool pipeline) { m_pipeline = pipeline; }
+		bool pipeline() const { return m_pipeline; }
+
+		// Extracted files are not synced one by one. If set, extract()
+		// ends with syncing the file system of the destination directory.
+		void setSync(bool sync) { m_sync = sync; }
+		bool sync() const { return m_sync; }
+
+		// process() and verifyMd5() read the archives of each device as
+		// a stream of their own, so archives on different disks are read
+		// at the same time. Archives are on the device they are stored on
+		// (st_dev) unless they are assigned to a named one. Each device
+		// gets up to deviceThreads() workers, by default threads() are
+		// split among the devices.
+		typedef boost::unordered_map<uint16_t, std::string> Devices;
+		void setDevice(uint16_t archive, const std::string &device) { m_devices[archive] = device; }
+		const Devices &devices() const { return m_devices; }
+		void setDeviceThreads(unsigned int threads) { m_deviceThreads = threads; }
+		unsigned int deviceThreads() const { return m_deviceThreads; }
+
+		// ids of all files in the order process() handles them
+		void schedule(std::vector<Index::Id> &files) const;
+
+		// only the last occurence of a file is used, earlier ones are
+		// shadowed by it
+		bool shadowed(Index::Id file) const { return file < m_shadowed.size() && m_shadowed[file]; }
+
+		// these do not load anything, so in lazy mode filecount() still
+		// counts duplicates in directories that are not loaded yet
+		size_t filecount() const;
+		size_t dircount() const { return m_index.dirs() - 1; }
+		void archives(std::vector<uint16_t> &ids) const { m_index.archives(ids); }
 
 	private:
 		typedef bool (Handler::*ErrorMethod)(const std::exception &exc, const std::string &path);
 
-		void read(FileIO &io);
-		void filter(Dir &dir, const std::set<Node*> &keep);
-		void process(const Nodes &nodes, const std::vector<std::string> &prefix, Archives &archives, DataHandlerFactory &factory) const;
+		struct CacheKey {
+			uint64_t size;
+			int64_t  mtime;
+			uint32_t mtimeNsec;
+		};
+
+		void init(const boost::filesystem::path &path);
+		template<typename Reader> void parse(Reader &reader, bool lazy);
+		template<typename Reader> void parseFooter(Reader &reader);
+		bool readCache(const CacheKey &key);
+		void writeCache(const CacheKey &key);
+		void buildTree();
+		void clearTree();
+		void load(Dir &dir);
+		Node *lookup(const char *path, size_t length);
+		void addFiles(Index::Id first, Index::Id last);
+		void dropShadowed();
+		Dir *newDir(const char *name, Index::Id id = Index::ROOT);
+
+		struct ProcessResult;
+		class UringProcess;
+		class Pipeline;
+		void report(ProcessResult &result, uint16_t archive) const;
 
 		bool direrror(const std::exception &exc, const std::string &path)     const { return error(exc, path, &Handler::direrror); }
 		bool fileerror(const std::exception &exc, const std::string &path)    const { return error(exc, path, &Handler::fileerror); }
@@ -97,9 +264,41 @@ namespace Vpk {
 		unsigned int m_dataOffset;
 		unsigned int m_footerOffset;
 		unsigned int m_footerSize;
+		unsigned int m_archiveMd5Size;
+		unsigned int m_otherMd5Size;
+		unsigned int m_signatureSize;
+		std::vector<ChunkHash> m_chunkHashes;
+		Md5::Digest  m_treeMd5;
+		Md5::Digest  m_chunkHashesMd5;
+		Md5::Digest  m_fileMd5;
+		bool         m_hasMd5;
 		std::string  m_srcdir;
 		std::string  m_dirfile;
+		std::string  m_name;
+		std::string  m_cacheDir;
+		MappedFile   m_mapping; // backs preload data, declared before the index
+		Index        m_index;
+		Arena        m_arena;
+		std::vector<Dir*> m_dirs;
+		std::vector<Dir*> m_dirById;
+		std::vector<File*> m_fileById;
+		std::vector<bool> m_shadowed;
+		size_t            m_shadowedFiles;
+		bool         m_lazy;
+		bool         m_archiveOrder;
+		bool         m_uring;
+		bool         m_pipeline;
+		bool         m_sync;
+		unsigned int m_threads;
+		unsigned int m_deviceThreads;
+		Devices      m_devices;
+		size_t       m_readSize;
+		size_t       m_readGap;
 		Handler     *m_handler;
+
+		// guards lazy loading, see setLazy()
+		mutable std::recursive_mutex m_loadMutex;
+		std::atomic<size_t> m_unloaded; // directories with a loader
 	};
 }
 
@@ -0,0 +1,112 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_RING_H
+#define VPK_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct iovec;
+
+namespace Vpk {
+	// A minimal io_uring on top of the raw system calls, so no liburing
+	// is needed. Requests are queued and only submitted by submit(),
+	// wait() or when the submission queue is full. Operations that are
+	// linked are only started once the previous one succeeded.
+	//
+	// All methods may throw Vpk::IOError.
+	class Ring {
+	public:
+		struct Completion {
+			uint64_t data;
+			int32_t  result;
+		};
+
+		// whether the kernel supports everything used here
+		static bool supported();
+
+		explicit Ring(unsigned int entries);
+		~Ring();
+
+		// Buffers registered with the kernel are used by passing their
+		// index to read() and write(). The files table has count empty
+		// slots that openat() and close() use.
+		void registerBuffers(const struct iovec *buffers, unsigned int count);
+		void registerFiles(unsigned int count);
+
+		// makes sure count requests can be queued without submitting in
+		// between, e.g. for a linked chain
+		void reserve(unsigned int count);
+
+		// with fixed set fd is a slot of the files table
+		void read(int fd, bool fixed, char *buffer, size_t length, uint64_t offset, int bufferIndex, uint64_t data, bool link = false);
+		void write(int fd, bool fixed, const char *buffer, size_t length, uint64_t offset, int bufferIndex, uint64_t data, bool link = false);
+		void openat(int dirfd, const char *path, int flags, mode_t mode, unsigned int slot, uint64_t data, bool link = false);
+		void close(unsigned int slot, uint64_t data, bool link = false);
+
+		void submit();
+
+		// false if there is no completion right now
+		bool peek(Completion &completion);
+
+		// submits and blocks until there is a completion
+		void wait(Completion &completion);
+
+		// number of requests queued or running
+		size_t pending() const { return m_pending; }
+		unsigned int completionEntries() const { return m_cqEntries; }
+
+	private:
+		Ring(const Ring&);
+		Ring &operator = (const Ring&);
+
+		static bool probe();
+		void unmap();
+
+		struct io_uring_sqe *next(uint8_t opcode, uint64_t data, bool link);
+		void enter(unsigned int submit, unsigned int wait);
+
+		int       m_fd;
+		uint32_t  m_features;
+		void     *m_sqRing;
+		size_t    m_sqRingSize;
+		void     *m_cqRing;
+		size_t    m_cqRingSize;
+		struct io_uring_sqe *m_sqes;
+		size_t    m_sqesSize;
+
+		unsigned int *m_sqHead;
+		unsigned int *m_sqTail;
+		unsigned int *m_sqArray;
+		unsigned int  m_sqMask;
+		unsigned int  m_sqEntries;
+		unsigned int *m_cqHead;
+		unsigned int *m_cqTail;
+		unsigned int  m_cqMask;
+		unsigned int  m_cqEntries;
+		void         *m_cqes;
+
+		unsigned int  m_tail;     // local tail of the submission queue
+		unsigned int  m_queued;   // not yet submitted
+		size_t        m_pending;
+	};
+}
+
+#endif
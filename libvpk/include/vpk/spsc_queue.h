@@ -0,0 +1,67 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_SPSC_QUEUE_H
+#define VPK_SPSC_QUEUE_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace Vpk {
+	// Lock-free bounded queue between exactly one producer thread, which
+	// only calls push(), and one consumer thread, which only calls pop().
+	// Neither blocks, waiting is up to the caller.
+	template<typename T>
+	class SpscQueue : private boost::noncopyable {
+	public:
+		explicit SpscQueue(size_t capacity) : m_slots(capacity + 1), m_head(0), m_tail(0) {}
+
+		bool push(const T &value) {
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			size_t next = advance(tail);
+			if (next == m_head.load(std::memory_order_acquire)) return false;
+			m_slots[tail] = value;
+			m_tail.store(next, std::memory_order_release);
+			return true;
+		}
+
+		bool pop(T &value) {
+			size_t head = m_head.load(std::memory_order_relaxed);
+			if (head == m_tail.load(std::memory_order_acquire)) return false;
+			value = m_slots[head];
+			m_head.store(advance(head), std::memory_order_release);
+			return true;
+		}
+
+		size_t capacity() const { return m_slots.size() - 1; }
+
+	private:
+		size_t advance(size_t index) const { return index + 1 == m_slots.size() ? 0 : index + 1; }
+
+		std::vector<T> m_slots;
+		// on their own cache lines, each is written by one side only
+		alignas(64) std::atomic<size_t> m_head;
+		alignas(64) std::atomic<size_t> m_tail;
+	};
+}
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_TAR_DATA_HANDLER_H
+#define VPK_TAR_DATA_HANDLER_H
+
+#include <mutex>
+
+#include <vpk/checking_data_handler.h>
+#include <vpk/tar_writer.h>
+
+namespace Vpk {
+	// Appends a file to a tar stream shared by all handlers of a factory.
+	// The stream is locked from reserve(), which writes the header, until
+	// the handler is finished or destroyed.
+	class TarDataHandler : public CheckingDataHandler {
+	public:
+		typedef CheckingDataHandler super_type;
+
+		TarDataHandler(TarWriter &tar, std::mutex &mutex, const std::string &path, uint32_t crc32, bool check) :
+			CheckingDataHandler(path, crc32), m_tar(tar), m_lock(mutex, std::defer_lock), m_check(check) {}
+		~TarDataHandler();
+
+		void reserve(uint64_t size);
+
+		void process(const char *buffer, size_t length) {
+			if (m_check) super_type::process(buffer, length);
+			tar().write(buffer, length);
+		}
+
+		// without checking the data is copied in the kernel if possible
+		size_t copy(int fd, uint64_t offset, size_t length) {
+			return m_check ? 0 : tar().writeFrom(fd, offset, length);
+		}
+
+		void finish();
+
+		bool check() const { return m_check; }
+
+	private:
+		TarWriter &tar();
+
+		TarWriter                   &m_tar;
+		std::unique_lock<std::mutex> m_lock;
+		bool                         m_check;
+	};
+}
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_TAR_DATA_HANDLER_FACTORY_H
+#define VPK_TAR_DATA_HANDLER_FACTORY_H
+
+#include <mutex>
+
+#include <vpk/tar_data_handler.h>
+#include <vpk/data_handler_factory.h>
+
+namespace Vpk {
+	// Writes files as a tar stream instead of creating them. Call
+	// finish() after Package::process() to end the stream.
+	class TarDataHandlerFactory : public DataHandlerFactory {
+	public:
+		TarDataHandlerFactory(const boost::filesystem::path &path, bool check, time_t mtime)
+		: m_tar(path, mtime), m_check(check) {}
+
+		// takes ownership of fd
+		TarDataHandlerFactory(int fd, bool check, time_t mtime)
+		: m_tar(fd, mtime), m_check(check) {}
+
+		// e.g. a Vpk::GzipBundle
+		TarDataHandlerFactory(TarWriter::Output &output, bool check, time_t mtime)
+		: m_tar(output, mtime), m_check(check) {}
+
+		TarDataHandler *create(const std::string &path, uint32_t crc32) {
+			return new TarDataHandler(m_tar, m_mutex, path, crc32, m_check);
+		}
+
+		// small files are appended under one lock
+		bool batches() const { return true; }
+		void process(std::vector<DataEntry> &entries);
+
+		void finish() { m_tar.finish(); }
+
+		bool check() const { return m_check; }
+
+	private:
+		TarWriter  m_tar;
+		std::mutex m_mutex;
+		bool       m_check;
+	};
+}
+
+#endif
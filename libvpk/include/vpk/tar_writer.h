@@ -0,0 +1,92 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_TAR_WRITER_H
+#define VPK_TAR_WRITER_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/filesystem/path.hpp>
+
+namespace Vpk {
+	// Writes regular files as a POSIX ustar stream, with a pax header for
+	// paths that don't fit into ustar's name and prefix fields. Not
+	// thread safe.
+	class TarWriter : private boost::noncopyable {
+	public:
+		static const size_t BLOCK_SIZE = 512;
+
+		// where the stream goes
+		class Output {
+		public:
+			virtual ~Output() {}
+
+			virtual void write(const char *buffer, size_t length) = 0;
+			// copies in the kernel if possible, returns how much was copied
+			virtual size_t writeFrom(int, uint64_t, size_t) { return 0; }
+			// the data of a file of size bytes starts at offset of the stream
+			virtual void entry(const std::string&, uint64_t, uint64_t) {}
+			// after the end of the archive
+			virtual void finish() {}
+		};
+
+		// files get mtime as modification time
+		TarWriter(const boost::filesystem::path &path, time_t mtime);
+		// takes ownership of fd, which may be a pipe
+		TarWriter(int fd, time_t mtime);
+		TarWriter(Output &output, time_t mtime);
+
+		// starts a file of size bytes
+		void begin(const std::string &path, uint64_t size);
+		void write(const char *buffer, size_t length);
+		// copies archive data in the kernel, see FileIO::writeFrom
+		size_t writeFrom(int fd, uint64_t offset, size_t length);
+		// Ends the current file. Whatever is missing of its size is
+		// filled with zeros, so the stream stays intact.
+		void end();
+
+		// writes the end of archive marker and finishes the output
+		void finish();
+
+		bool     inFile()    const { return m_inFile; }
+		uint64_t remaining() const { return m_size - m_written; }
+		// bytes written so far
+		uint64_t offset()    const { return m_offset; }
+
+	private:
+		void header(const std::string &name, char type, uint64_t size);
+		void pad(uint64_t count);
+		void wrote(uint64_t count);
+		void output(const char *buffer, size_t length);
+
+		boost::scoped_ptr<Output> m_file; // the output, if it is a file
+		Output  &m_output;
+		time_t   m_mtime;
+		uint64_t m_offset;
+		bool     m_inFile;
+		uint64_t m_size;
+		uint64_t m_written;
+	};
+}
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdint.h>
+
+#include <vpk/arena.h>
+
+void *Vpk::Arena::allocate(size_t size, size_t align) {
+	uintptr_t ptr = ((uintptr_t) m_ptr + align - 1) & ~(uintptr_t)(align - 1);
+	if (!m_ptr || ptr + size > (uintptr_t) m_end) {
+		// oversized allocations get a block of their own so the rest of
+		// the current block is not wasted
+		if (size + align > m_blockSize / 4) {
+			char *block = new char[size + align];
+			m_blocks.push_back(block);
+			m_used += size;
+			return (void*) (((uintptr_t) block + align - 1) & ~(uintptr_t)(align - 1));
+		}
+
+		char *block = new char[m_blockSize];
+		m_blocks.push_back(block);
+		m_ptr = block;
+		m_end = block + m_blockSize;
+		ptr = ((uintptr_t) m_ptr + align - 1) & ~(uintptr_t)(align - 1);
+	}
+
+	m_ptr   = (char*) (ptr + size);
+	m_used += size;
+	return (void*) ptr;
+}
+
+const char *Vpk::Arena::strdup(const char *str, size_t length) {
+	char *copy = (char*) allocate(length + 1, 1);
+	memcpy(copy, str, length);
+	copy[length] = '\0';
+	return copy;
+}
+
+void Vpk::Arena::clear() {
+	for (std::vector<char*>::iterator i = m_blocks.begin(); i != m_blocks.end(); ++ i) {
+		delete[] *i;
+	}
+	m_blocks.clear();
+	m_used = 0;
+	m_ptr  = 0;
+	m_end  = 0;
+}
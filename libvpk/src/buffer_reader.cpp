@@ -16,29 +16,21 @@
  * License along with this library; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
-#include <algorithm>
+#include <errno.h>
 
-#include <vpk/file.h>
-#include <vpk/file_format_error.h>
+#include <vpk/buffer_reader.h>
 
-void Vpk::File::read(FileIO &io, std::vector<File*> &dirfiles) {
-	crc32 = io.readLU32();
-	unsigned int length = io.readLU16();
-	index = io.readLU16();
-	offset = io.readLU32();
-	size = io.readLU32();
-
-	unsigned int terminator = io.readLU16();
-	if (terminator != 0xFFFF) {
-		throw FileFormatError("invalid terminator");
-	}
-
-	if (length > 0) {
-		preload.resize(length, 0);
-		io.read(&preload[0], length);
+void Vpk::BufferReader::seek(off_t offset, FileIO::Whence whence) {
+	const char *base = 0;
+	switch (whence) {
+	case FileIO::SET: base = m_begin; break;
+	case FileIO::END: base = m_end;   break;
+	case FileIO::CUR:
+	default:          base = m_ptr;   break;
 	}
 
-	if (index == 0x7fff) {
-		dirfiles.push_back(this);
+	if (offset < m_begin - base || offset > m_end - base) {
+		throw IOError(EINVAL);
 	}
+	m_ptr = base + offset;
 }
@@ -21,9 +21,19 @@
 #include <vpk/exception.h>
 #include <vpk/checking_data_handler.h>
 
-void Vpk::CheckingDataHandler::finish() {
-	uint32_t sum = m_hash.checksum();
-	if (sum != crc32()) {
-		throw Exception((boost::format("checksum missmatch, expected 0x%08x, got 0x%08x") % crc32() % sum).str());
+void Vpk::CheckingDataHandler::verify(uint32_t expected, uint32_t sum) {
+	if (sum != expected) {
+		throw Exception((boost::format("checksum missmatch, expected 0x%08x, got 0x%08x") % expected % sum).str());
 	}
 }
+
+void Vpk::CheckingDataHandler::finish() {
+	verify(crc32(), m_hash.checksum());
+}
+
+void Vpk::CheckingDataHandler::check(const DataEntry &entry) {
+	Crc32 hash;
+	hash.process(entry.preload, entry.preloadSize);
+	hash.process(entry.data, entry.size);
+	verify(entry.crc32, hash.checksum());
+}
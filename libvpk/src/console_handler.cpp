@@ -22,10 +22,10 @@
 
 #include <vpk/console_handler.h>
 
-void Vpk::ConsoleHandler::begin(const Package &package) {
+void Vpk::ConsoleHandler::begin(const Package&, size_t count) {
 	m_begun      = true;
 	m_extracting = false;
-	m_filecount  = package.filecount();
+	m_filecount  = count;
 	m_success = 0;
 	m_fail    = 0;
 	m_failedArchs.clear();
@@ -104,6 +104,11 @@ void Vpk::ConsoleHandler::success(const std::string&) {
 	std::cout << std::endl;
 }
 
+void Vpk::ConsoleHandler::stage(const char *name, double busy, double total) {
+	std::cout << boost::format("%s stage: busy %.2lf of %.2lf seconds (%.0lf%%)")
+		% name % busy % total % (total > 0 ? 100 * busy / total : 0.0) << std::endl;
+}
+
 void Vpk::ConsoleHandler::print(const std::string &msg) {
 	if (m_begun) {
 		std::cout << (boost::format("[ %3.0lf%% ] %s") % (100 * progress()) % msg).str() << std::flush;
@@ -0,0 +1,284 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <endian.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define VPK_CRC32_X86
+#	include <immintrin.h>
+#endif
+
+#include <vpk/crc32.h>
+#include <vpk/exception.h>
+
+// reflected polynomial
+static const uint32_t POLY = 0xEDB88320;
+
+struct Tables {
+	uint32_t table[16][256];
+
+	Tables() {
+		for (uint32_t i = 0; i < 256; ++ i) {
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; ++ bit) {
+				crc = (crc >> 1) ^ (crc & 1 ? POLY : 0);
+			}
+			table[0][i] = crc;
+		}
+		for (size_t k = 1; k < 16; ++ k) {
+			for (uint32_t i = 0; i < 256; ++ i) {
+				uint32_t crc = table[k - 1][i];
+				table[k][i] = (crc >> 8) ^ table[0][crc & 0xFF];
+			}
+		}
+	}
+};
+
+static const Tables &tables() {
+	static const Tables tables;
+	return tables;
+}
+
+static uint32_t updateBytes(const uint32_t table[256], uint32_t crc, const unsigned char *data, size_t length) {
+	for (const unsigned char *end = data + length; data < end; ++ data) {
+		crc = table[(crc ^ *data) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+// 16 table lookups per 16 bytes, independent of each other
+static uint32_t updateSlicingBy16(uint32_t crc, const char *buffer, size_t length) {
+	const uint32_t (*table)[256] = tables().table;
+	const unsigned char *data = (const unsigned char*) buffer;
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	for (; length >= 16; data += 16, length -= 16) {
+		uint32_t words[4];
+		memcpy(words, data, 16);
+		uint32_t a = words[0] ^ crc;
+		uint32_t b = words[1];
+		uint32_t c = words[2];
+		uint32_t d = words[3];
+
+		crc = table[15][a & 0xFF] ^ table[14][(a >> 8) & 0xFF] ^ table[13][(a >> 16) & 0xFF] ^ table[12][a >> 24] ^
+		      table[11][b & 0xFF] ^ table[10][(b >> 8) & 0xFF] ^ table[ 9][(b >> 16) & 0xFF] ^ table[ 8][b >> 24] ^
+		      table[ 7][c & 0xFF] ^ table[ 6][(c >> 8) & 0xFF] ^ table[ 5][(c >> 16) & 0xFF] ^ table[ 4][c >> 24] ^
+		      table[ 3][d & 0xFF] ^ table[ 2][(d >> 8) & 0xFF] ^ table[ 1][(d >> 16) & 0xFF] ^ table[ 0][d >> 24];
+	}
+#endif
+
+	return updateBytes(table[0], crc, data, length);
+}
+
+#ifdef VPK_CRC32_X86
+// Folding with carry-less multiplication as described in "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ Instruction" by
+// Gopal et al. (Intel, 2009). The constants are x^(n+32) mod P and
+// x^(n-32) mod P, bit reflected and shifted left by one, for a folding
+// distance of n bits.
+static const uint64_t FOLD_2048[2] = { 0x011542778a, 0x01322d1430 };
+static const uint64_t FOLD_512[2]  = { 0x0154442bd4, 0x01c6e41596 };
+static const uint64_t FOLD_128[2]  = { 0x01751997d0, 0x00ccaa009e };
+static const uint64_t FOLD_64[2]   = { 0x0163cd6124, 0x0000000000 };
+static const uint64_t BARRETT[2]   = { 0x01db710641, 0x01f7011641 }; // P(x)' and u'
+
+__attribute__((target("pclmul,sse4.1"), always_inline))
+static inline __m128i fold128(__m128i x, __m128i k, __m128i data) {
+	return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), data);
+}
+
+// Reduces four 128 bit lanes (x1 first) and then whole 16 byte blocks
+// to the CRC. length has to be a multiple of 16. Always inlined, so the
+// AVX-512 kernel does not switch to legacy SSE code.
+__attribute__((target("pclmul,sse4.1"), always_inline))
+static inline uint32_t reduce128(__m128i x1, __m128i x2, __m128i x3, __m128i x4, const unsigned char *data, size_t length) {
+	__m128i k = _mm_loadu_si128((const __m128i*) FOLD_128);
+	x1 = fold128(x1, k, x2);
+	x1 = fold128(x1, k, x3);
+	x1 = fold128(x1, k, x4);
+
+	for (; length >= 16; data += 16, length -= 16) {
+		x1 = fold128(x1, k, _mm_loadu_si128((const __m128i*) data));
+	}
+
+	// 128 to 64 bits
+	__m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k, 0x10));
+
+	k = _mm_loadl_epi64((const __m128i*) FOLD_64);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00), _mm_srli_si128(x1, 4));
+
+	// Barrett reduction to 32 bits
+	k = _mm_loadu_si128((const __m128i*) BARRETT);
+	__m128i t = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+	t = _mm_clmulepi64_si128(_mm_and_si128(t, mask), k, 0x00);
+	x1 = _mm_xor_si128(x1, t);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+// 4 x 16 bytes in flight
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t updatePclmul(uint32_t crc, const char *buffer, size_t length) {
+	const unsigned char *data = (const unsigned char*) buffer;
+	if (length < 64) {
+		return updateSlicingBy16(crc, buffer, length);
+	}
+
+	__m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (data +  0)), _mm_cvtsi32_si128(crc));
+	__m128i x2 = _mm_loadu_si128((const __m128i*) (data + 16));
+	__m128i x3 = _mm_loadu_si128((const __m128i*) (data + 32));
+	__m128i x4 = _mm_loadu_si128((const __m128i*) (data + 48));
+	data   += 64;
+	length -= 64;
+
+	__m128i k = _mm_loadu_si128((const __m128i*) FOLD_512);
+	for (; length >= 64; data += 64, length -= 64) {
+		x1 = fold128(x1, k, _mm_loadu_si128((const __m128i*) (data +  0)));
+		x2 = fold128(x2, k, _mm_loadu_si128((const __m128i*) (data + 16)));
+		x3 = fold128(x3, k, _mm_loadu_si128((const __m128i*) (data + 32)));
+		x4 = fold128(x4, k, _mm_loadu_si128((const __m128i*) (data + 48)));
+	}
+
+	size_t blocks = length & ~(size_t) 15;
+	crc = reduce128(x1, x2, x3, x4, data, blocks);
+	return updateBytes(tables().table[0], crc, data + blocks, length - blocks);
+}
+
+__attribute__((target("pclmul,sse4.1,avx512f,vpclmulqdq")))
+static inline __m512i fold512(__m512i x, __m512i k, __m512i data) {
+	return _mm512_xor_si512(_mm512_xor_si512(_mm512_clmulepi64_epi128(x, k, 0x00), _mm512_clmulepi64_epi128(x, k, 0x11)), data);
+}
+
+// 4 x 64 bytes in flight
+__attribute__((target("pclmul,sse4.1,avx512f,vpclmulqdq")))
+static uint32_t updateVpclmul(uint32_t crc, const char *buffer, size_t length) {
+	const unsigned char *data = (const unsigned char*) buffer;
+	if (length < 256) {
+		return updatePclmul(crc, buffer, length);
+	}
+
+	__m512i x1 = _mm512_xor_si512(_mm512_loadu_si512(data), _mm512_inserti32x4(_mm512_setzero_si512(), _mm_cvtsi32_si128(crc), 0));
+	__m512i x2 = _mm512_loadu_si512(data +  64);
+	__m512i x3 = _mm512_loadu_si512(data + 128);
+	__m512i x4 = _mm512_loadu_si512(data + 192);
+	data   += 256;
+	length -= 256;
+
+	__m512i k = _mm512_set4_epi64(FOLD_2048[1], FOLD_2048[0], FOLD_2048[1], FOLD_2048[0]);
+	for (; length >= 256; data += 256, length -= 256) {
+		x1 = fold512(x1, k, _mm512_loadu_si512(data));
+		x2 = fold512(x2, k, _mm512_loadu_si512(data +  64));
+		x3 = fold512(x3, k, _mm512_loadu_si512(data + 128));
+		x4 = fold512(x4, k, _mm512_loadu_si512(data + 192));
+	}
+
+	k  = _mm512_set4_epi64(FOLD_512[1], FOLD_512[0], FOLD_512[1], FOLD_512[0]);
+	x1 = fold512(x1, k, x2);
+	x1 = fold512(x1, k, x3);
+	x1 = fold512(x1, k, x4);
+	for (; length >= 64; data += 64, length -= 64) {
+		x1 = fold512(x1, k, _mm512_loadu_si512(data));
+	}
+
+	__m128i lanes[4];
+	_mm512_storeu_si512(lanes, x1);
+
+	size_t blocks = length & ~(size_t) 15;
+	crc = reduce128(lanes[0], lanes[1], lanes[2], lanes[3], data, blocks);
+	return updateBytes(tables().table[0], crc, data + blocks, length - blocks);
+}
+#endif
+
+bool Vpk::Crc32::supported(Kernel kernel) {
+	switch (kernel) {
+	case SLICING_BY_16:
+		return true;
+
+#ifdef VPK_CRC32_X86
+	case PCLMUL:
+		return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+
+	case VPCLMUL:
+		return supported(PCLMUL) && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq");
+#endif
+
+	default:
+		return false;
+	}
+}
+
+Vpk::Crc32::Kernel Vpk::Crc32::best() {
+	static const Kernel kernel =
+		supported(VPCLMUL) ? VPCLMUL :
+		supported(PCLMUL)  ? PCLMUL  : SLICING_BY_16;
+	return kernel;
+}
+
+const char *Vpk::Crc32::name(Kernel kernel) {
+	switch (kernel) {
+	case SLICING_BY_16: return "slicing-by-16";
+	case PCLMUL:        return "pclmul";
+	case VPCLMUL:       return "vpclmul";
+	default:            return "unknown";
+	}
+}
+
+Vpk::Crc32::Crc32(Kernel kernel) : m_state(0xFFFFFFFF), m_update(0) {
+	if (!supported(kernel)) {
+		throw Exception(std::string("CRC32 kernel not supported: ") + name(kernel));
+	}
+	m_update = update(kernel);
+}
+
+Vpk::Crc32::Update Vpk::Crc32::update(Kernel kernel) {
+	switch (kernel) {
+#ifdef VPK_CRC32_X86
+	case PCLMUL:  return updatePclmul;
+	case VPCLMUL: return updateVpclmul;
+#endif
+	default:      return updateSlicingBy16;
+	}
+}
+
+// a * b modulo the polynomial, with reflected bits like the checksums;
+// a must not be 0
+static uint32_t multiply(uint32_t a, uint32_t b) {
+	uint32_t product = 0;
+	for (uint32_t mask = 1u << 31;; mask >>= 1) {
+		if (a & mask) {
+			product ^= b;
+			if ((a & (mask - 1)) == 0) break;
+		}
+		b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+	}
+	return product;
+}
+
+// Appending lengthB bytes multiplies the CRC register of A by
+// x^(8 * lengthB), which is found by repeated squaring (as in zlib).
+uint32_t Vpk::Crc32::combine(uint32_t crcA, uint32_t crcB, uint64_t lengthB) {
+	uint32_t power  = 1u << 31; // x^0
+	uint32_t square = 1u << 23; // x^8
+	for (; lengthB > 0; lengthB >>= 1) {
+		if (lengthB & 1) power = multiply(square, power);
+		square = multiply(square, square);
+	}
+	return multiply(power, crcA) ^ crcB;
+}
@@ -16,59 +16,49 @@
  * License along with this library; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
-#include <iostream>
-
 #include <vpk/dir.h>
-#include <vpk/file.h>
-
-void Vpk::Dir::read(FileIO &io, const std::string &path, const std::string &type, std::vector<File*> &dirfiles) {
-	// files
-	for (;;) {
-		std::string name;
-		io.readAsciiZ(name);
-		if (name.empty()) break;
 
-		name += ".";
-		name += type;
-		if (m_nodes.find(name) != m_nodes.end()) {
-			std::cerr
-				<< "*** warning: file occured more than once: \""
-				<< path << "/" << name << "\"\n";
-		}
-		File *file = new File(name);
-		m_nodes[name] = NodePtr(file);
-		file->read(io, dirfiles);
+void Vpk::Dir::load() const {
+	Loader *loader = m_loader.load(std::memory_order_acquire);
+	if (loader) {
+		loader->load(const_cast<Dir&>(*this));
 	}
 }
 
-const Vpk::Node *Vpk::Dir::node(const std::string &name) const {
+const Vpk::Node *Vpk::Dir::node(const char *name) const {
+	load();
 	Nodes::const_iterator i = m_nodes.find(name);
 	if (i == m_nodes.end()) {
 		return 0;
 	}
 	else {
-		return i->second.get();
+		return i->second;
 	}
 }
 
-Vpk::Node *Vpk::Dir::node(const std::string &name) {
+Vpk::Node *Vpk::Dir::node(const char *name) {
+	load();
 	Nodes::iterator i = m_nodes.find(name);
 	if (i == m_nodes.end()) {
 		return 0;
 	}
 	else {
-		return i->second.get();
+		return i->second;
 	}
 }
 
-void Vpk::Dir::add(Node *node) {
-	m_nodes[node->name()] = NodePtr(node);
+Vpk::Node *Vpk::Dir::add(Node *node) {
+	NodePtr &slot = m_nodes[node->name()];
+	Node *replaced = slot;
+	slot = node;
 	if (node->type() == DIR) {
 		++ m_subdirs;
 	}
+	return replaced;
 }
 
-void Vpk::Dir::remove(const std::string &name) {
+void Vpk::Dir::remove(const char *name) {
+	load();
 	Nodes::iterator i = m_nodes.find(name);
 	if (i != m_nodes.end()) {
 		if (i->second->type() == DIR) {
@@ -77,3 +67,9 @@ void Vpk::Dir::remove(const std::string &name) {
 		m_nodes.erase(i);
 	}
 }
+
+void Vpk::Dir::clear() {
+	m_nodes.clear();
+	m_subdirs = 0;
+	setLoader(0);
+}
@@ -0,0 +1,136 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <vpk/dir_cache.h>
+#include <vpk/io_error.h>
+#include <vpk/util.h>
+
+static const int DIR_FLAGS  = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+static const int FILE_FLAGS = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+// paths are below the root even if they start with '/'
+static const char *relative(const std::string &path) {
+	const char *str = path.c_str();
+	while (*str == '/') ++ str;
+	return str;
+}
+
+int Vpk::DirCache::root() {
+	if (m_rootFd < 0) {
+		create_path(m_root);
+		m_rootFd = ::open(m_root.c_str(), DIR_FLAGS);
+		if (m_rootFd < 0) {
+			throw IOError(errno);
+		}
+	}
+	return m_rootFd;
+}
+
+// Missing parents are created first. A parent's descriptor is only used
+// before the child is added, which might close it.
+int Vpk::DirCache::dir(const std::string &path) {
+	if (path.empty()) {
+		return root();
+	}
+
+	boost::unordered_map<std::string, Lru::iterator>::iterator found = m_fds.find(path);
+	if (found != m_fds.end()) {
+		m_lru.splice(m_lru.begin(), m_lru, found->second);
+		return found->second->second;
+	}
+
+	int fd;
+	if (created(path)) {
+		fd = openat(root(), relative(path), DIR_FLAGS);
+	}
+	else {
+		size_t slash = path.rfind('/');
+		int parent = dir(slash == std::string::npos ? std::string() : path.substr(0, slash));
+		const char *name = path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+		if (!*name) {
+			return parent;
+		}
+
+		if (mkdirat(parent, name, 0777) != 0 && errno != EEXIST) {
+			throw IOError(errno);
+		}
+		fd = openat(parent, name, DIR_FLAGS);
+	}
+	if (fd < 0) {
+		throw IOError(errno);
+	}
+
+	if (m_fds.size() >= m_capacity) {
+		::close(m_lru.back().second);
+		m_fds.erase(m_lru.back().first);
+		m_lru.pop_back();
+	}
+	m_lru.push_front(std::make_pair(path, fd));
+	m_fds[path] = m_lru.begin();
+	m_created.insert(path);
+	return fd;
+}
+
+int Vpk::DirCache::create(const std::string &path) {
+	size_t slash = path.rfind('/');
+	int fd;
+	if (slash == std::string::npos) {
+		fd = openat(root(), path.c_str(), FILE_FLAGS, 0666);
+	}
+	else {
+		std::string parent = path.substr(0, slash);
+		if (created(parent) && m_fds.find(parent) == m_fds.end()) {
+			fd = openat(root(), relative(path), FILE_FLAGS, 0666);
+		}
+		else {
+			fd = openat(dir(parent), path.c_str() + slash + 1, FILE_FLAGS, 0666);
+		}
+	}
+	if (fd < 0) {
+		throw IOError(errno);
+	}
+	return fd;
+}
+
+void Vpk::DirCache::sync() {
+#ifdef __linux__
+	if (syncfs(root()) != 0) {
+		throw IOError(errno);
+	}
+#else
+	::sync();
+#endif
+}
+
+void Vpk::DirCache::clear() {
+	for (Lru::iterator i = m_lru.begin(); i != m_lru.end(); ++ i) {
+		::close(i->second);
+	}
+	m_lru.clear();
+	m_fds.clear();
+	m_created.clear();
+	if (m_rootFd >= 0) {
+		::close(m_rootFd);
+		m_rootFd = -1;
+	}
+}
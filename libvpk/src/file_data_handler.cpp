@@ -16,15 +16,83 @@
  * License along with this library; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
 #include <vpk/file_data_handler.h>
 #include <vpk/util.h>
+#include <vpk/io_error.h>
 
 namespace fs = boost::filesystem;
 
+const uint64_t Vpk::FileDataHandler::RESERVE_SIZE;
+const uint64_t Vpk::FileDataHandler::WRITE_BEHIND;
+
 Vpk::FileDataHandler::FileDataHandler(
-	const fs::path &path, uint32_t crc32, bool check)
-: CheckingDataHandler(path.string(), crc32), m_check(check) {
+	const fs::path &path, uint32_t crc32, bool check, bool sync)
+: CheckingDataHandler(path.string(), crc32), m_check(check), m_sync(sync), m_written(0), m_started(0) {
 	create_path(path.parent_path());
 
 	m_io.open(path, "wb");
+	m_io.setnobuf();
+}
+
+Vpk::FileDataHandler::FileDataHandler(
+	DirCache &dirs, const std::string &path, uint32_t crc32, bool check, bool sync)
+: CheckingDataHandler((dirs.path() / path).string(), crc32), m_check(check), m_sync(sync), m_written(0), m_started(0) {
+	int fd = dirs.create(path);
+	try {
+		m_io.open(fd, "wb");
+	}
+	catch (...) {
+		::close(fd);
+		throw;
+	}
+	m_io.setnobuf();
+}
+
+// Starts writing back what was written since the last call without
+// waiting for it, so the disk is kept busy while reading goes on and
+// the sync at the end has less left to do. The kernel's dirty page
+// limits throttle writing if the disk can't keep up.
+void Vpk::FileDataHandler::writeBehind() {
+	m_io.syncRange(m_started, m_written - m_started, false);
+	m_started = m_written;
+}
+
+void Vpk::FileDataHandler::write(int fd, const DataEntry &entry) {
+	struct iovec iov[2];
+	iov[0].iov_base = const_cast<char*>(entry.preload);
+	iov[0].iov_len  = entry.preloadSize;
+	iov[1].iov_base = const_cast<char*>(entry.data);
+	iov[1].iov_len  = entry.size;
+
+	struct iovec *next = iov;
+	int count = 2;
+	while (count > 0) {
+		if (next->iov_len == 0) {
+			++ next;
+			-- count;
+			continue;
+		}
+		ssize_t written = ::writev(fd, next, count);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			int errnum = errno;
+			::close(fd);
+			throw IOError(errnum);
+		}
+		for (; count > 0 && (size_t) written >= next->iov_len; ++ next, -- count) {
+			written -= next->iov_len;
+		}
+		if (count > 0) {
+			next->iov_base = (char*) next->iov_base + written;
+			next->iov_len -= written;
+		}
+	}
+
+	if (::close(fd) != 0) {
+		throw IOError(errno);
+	}
 }
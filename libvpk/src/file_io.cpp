@@ -27,7 +27,9 @@
 #include <sys/stat.h>
 
 #if (_POSIX_C_SOURCE >= 1 || _XOPEN_SOURCE || _POSIX_SOURCE) && defined(__linux__)
+#include <fcntl.h>
 #include <sys/sendfile.h>
+#include <sys/syscall.h>
 #endif
 
 Vpk::FileIO &Vpk::FileIO::operator = (const FileIO &reader) {
@@ -269,6 +271,99 @@ size_t Vpk::FileIO::readSome(FileIO &dest, size_t size) {
 #endif
 }
 
+#if (_POSIX_C_SOURCE >= 1 || _XOPEN_SOURCE || _POSIX_SOURCE) && defined(__linux__)
+size_t Vpk::FileIO::writeFrom(int fd, off_t offset, size_t size) {
+	if (!m_stream) throw FileIOClosedError();
+	flush();
+	int out = ::fileno(m_stream);
+	size_t done = 0;
+	struct stat st;
+	if (fstat(out, &st) == 0 && S_ISFIFO(st.st_mode)) {
+		// moves the pages of the page cache into the pipe
+		while (done < size) {
+			loff_t pos = offset + done;
+			ssize_t count = splice(fd, &pos, out, NULL, size - done, SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (count < 0) {
+				if (errno == EINTR) continue;
+				if (errno == ENOSYS || errno == EINVAL) break;
+				throw IOError(errno);
+			}
+			else if (count == 0) {
+				return done;
+			}
+			done += count;
+		}
+	}
+#ifdef SYS_copy_file_range
+	// the kernel might not support it or not for this pair of files
+	while (done < size) {
+		loff_t pos = offset + done;
+		ssize_t count = syscall(SYS_copy_file_range, fd, &pos, out, NULL, size - done, 0);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == EBADF) break;
+			throw IOError(errno);
+		}
+		else if (count == 0) {
+			return done;
+		}
+		done += count;
+	}
+#endif
+	while (done < size) {
+		off_t pos = offset + done;
+		ssize_t count = sendfile(out, fd, &pos, size - done);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			if (errno == ENOSYS || errno == EINVAL) break;
+			throw IOError(errno);
+		}
+		else if (count == 0) {
+			break;
+		}
+		done += count;
+	}
+	return done;
+}
+
+void Vpk::FileIO::reserve(uint64_t size) {
+	if (!m_stream) throw FileIOClosedError();
+	reserve(::fileno(m_stream), size);
+}
+
+void Vpk::FileIO::reserve(int fd, uint64_t size) {
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) != 0 &&
+		errno != EOPNOTSUPP && errno != ENOSYS) {
+		throw IOError(errno);
+	}
+}
+
+void Vpk::FileIO::syncRange(off_t offset, off_t size, bool wait) {
+	if (!m_stream) throw FileIOClosedError();
+	unsigned int flags = wait ?
+		SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER :
+		SYNC_FILE_RANGE_WRITE;
+	if (sync_file_range(::fileno(m_stream), offset, size, flags) != 0 && errno != ENOSYS) {
+		throw IOError(errno);
+	}
+}
+#else
+size_t Vpk::FileIO::writeFrom(int, off_t, size_t) {
+	if (!m_stream) throw FileIOClosedError();
+	return 0;
+}
+
+void Vpk::FileIO::reserve(uint64_t) {
+	if (!m_stream) throw FileIOClosedError();
+}
+
+void Vpk::FileIO::reserve(int, uint64_t) {}
+
+void Vpk::FileIO::syncRange(off_t, off_t, bool) {
+	if (!m_stream) throw FileIOClosedError();
+}
+#endif
+
 void Vpk::FileIO::read(char *buf, size_t size) {
 	if (!m_stream) throw FileIOClosedError();
 	size_t count = fread(buf, size, 1, m_stream);
@@ -0,0 +1,311 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdlib.h>
+#include <inttypes.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+#include <boost/format.hpp>
+
+#include <vpk/gzip_bundle.h>
+#include <vpk/exception.h>
+
+namespace fs = boost::filesystem;
+
+static const char INDEX_MAGIC[] = "vpk-bundle-index 1\n";
+
+static std::string indexPath(const fs::path &path) {
+	return path.string() + ".idx";
+}
+
+static std::string zlibError(const char *what, const z_stream &stream, int status) {
+	return (boost::format("zlib %s error: %s") % what % (stream.msg ? stream.msg : zError(status))).str();
+}
+
+Vpk::GzipBundle::GzipBundle(const fs::path &path, unsigned int threads, int level, size_t blockSize) :
+		m_io(path, "wb"), m_index(indexPath(path), "wb"), m_level(level),
+		m_blockSize(blockSize > 0 ? blockSize : BLOCK_SIZE), m_offset(0), m_written(0),
+		m_block(new Block(0)), m_stop(false) {
+	m_index.write(INDEX_MAGIC);
+	m_block->data.reserve(m_blockSize);
+	if (threads == 0) threads = 1;
+	for (unsigned int i = 0; i < threads; ++ i) {
+		m_workers.push_back(std::thread(&GzipBundle::work, this));
+	}
+}
+
+Vpk::GzipBundle::~GzipBundle() {
+	stop();
+}
+
+void Vpk::GzipBundle::stop() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_ready.notify_all();
+	for (std::vector<std::thread>::iterator worker = m_workers.begin(); worker != m_workers.end(); ++ worker) {
+		if (worker->joinable()) worker->join();
+	}
+}
+
+void Vpk::GzipBundle::write(const char *buffer, size_t length) {
+	while (length > 0) {
+		size_t count = std::min(length, m_blockSize - m_block->data.size());
+		m_block->data.insert(m_block->data.end(), buffer, buffer + count);
+		buffer += count;
+		length -= count;
+		if (m_block->data.size() == m_blockSize) {
+			submit();
+		}
+	}
+}
+
+void Vpk::GzipBundle::entry(const std::string &path, uint64_t offset, uint64_t size) {
+	if (path.find('\n') != std::string::npos) {
+		throw Exception("file name contains a newline, which the bundle index does not support");
+	}
+	m_index.write((boost::format("file %" PRIu64 " %" PRIu64 " %s\n") % offset % size % path).str());
+}
+
+void Vpk::GzipBundle::finish() {
+	submit();
+	flush(true);
+	m_io.flush();
+	m_index.flush();
+}
+
+void Vpk::GzipBundle::submit() {
+	if (m_block->data.empty()) return;
+
+	uint64_t next = m_offset + m_block->data.size();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending.push_back(m_block);
+		m_queue.push_back(m_block);
+	}
+	m_ready.notify_one();
+
+	m_offset = next;
+	m_block.reset(new Block(next));
+	m_block->data.reserve(m_blockSize);
+
+	// bounds the memory used by blocks in flight
+	flush(false);
+}
+
+void Vpk::GzipBundle::flush(bool all) {
+	const size_t limit = all ? 0 : 2 * m_workers.size();
+	for (;;) {
+		boost::shared_ptr<Block> block;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_pending.empty() || (m_pending.size() <= limit && !m_pending.front()->done)) {
+				break;
+			}
+			m_done.wait(lock, [this]() { return m_pending.front()->done; });
+			block = m_pending.front();
+			m_pending.pop_front();
+		}
+
+		if (!block->error.empty()) {
+			throw Exception(block->error);
+		}
+
+		m_index.write((boost::format("block %" PRIu64 " %" PRIu64 "\n") % m_written % block->offset).str());
+		m_io.write(&block->compressed[0], block->compressed.size());
+		m_written += block->compressed.size();
+	}
+}
+
+void Vpk::GzipBundle::work() {
+	for (;;) {
+		boost::shared_ptr<Block> block;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_ready.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+			if (m_queue.empty()) return;
+			block = m_queue.front();
+			m_queue.pop_front();
+		}
+
+		// each block is a gzip member of its own
+		z_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		int status = deflateInit2(&stream, m_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+		if (status != Z_OK) {
+			block->error = zlibError("deflate", stream, status);
+		}
+		else {
+			block->compressed.resize(deflateBound(&stream, block->data.size()));
+			stream.next_in   = (Bytef*) &block->data[0];
+			stream.avail_in  = block->data.size();
+			stream.next_out  = (Bytef*) &block->compressed[0];
+			stream.avail_out = block->compressed.size();
+			status = deflate(&stream, Z_FINISH);
+			if (status != Z_STREAM_END) {
+				block->error = zlibError("deflate", stream, status);
+			}
+			block->compressed.resize(stream.total_out);
+			deflateEnd(&stream);
+		}
+		std::vector<char>().swap(block->data);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			block->done = true;
+		}
+		m_done.notify_all();
+	}
+}
+
+Vpk::GzipBundleReader::GzipBundleReader(const fs::path &path) : m_io(path, "rb") {
+	FileIO index(indexPath(path), "rb");
+	std::vector<char> text(index.size());
+	if (!text.empty()) index.read(&text[0], text.size());
+
+	const size_t magicSize = sizeof(INDEX_MAGIC) - 1;
+	if (text.size() < magicSize || memcmp(&text[0], INDEX_MAGIC, magicSize) != 0) {
+		throw Exception("not a bundle index: " + indexPath(path));
+	}
+
+	const char *ptr = &text[0] + magicSize;
+	const char *end = &text[0] + text.size();
+	while (ptr < end) {
+		const char *eol = std::find(ptr, end, '\n');
+		std::string line(ptr, eol);
+		ptr = eol + 1;
+
+		char *rest = 0;
+		if (line.compare(0, 6, "block ") == 0) {
+			BlockEntry block;
+			block.compressed = strtoull(line.c_str() + 6, &rest, 10);
+			block.offset     = strtoull(rest, &rest, 10);
+			m_blocks.push_back(block);
+		}
+		else if (line.compare(0, 5, "file ") == 0) {
+			Entry entry;
+			entry.offset = strtoull(line.c_str() + 5, &rest, 10);
+			entry.size   = strtoull(rest, &rest, 10);
+			if (*rest != ' ') {
+				throw Exception("illegal line in bundle index: " + line);
+			}
+			m_files[rest + 1] = entry;
+		}
+		else if (!line.empty()) {
+			throw Exception("illegal line in bundle index: " + line);
+		}
+	}
+	std::sort(m_blocks.begin(), m_blocks.end());
+}
+
+const Vpk::GzipBundleReader::Entry &Vpk::GzipBundleReader::find(const std::string &path) const {
+	boost::unordered_map<std::string, Entry>::const_iterator it = m_files.find(path);
+	if (it == m_files.end()) {
+		throw Exception("no such file in bundle: " + path);
+	}
+	return it->second;
+}
+
+uint64_t Vpk::GzipBundleReader::size(const std::string &path) const {
+	return find(path).size;
+}
+
+void Vpk::GzipBundleReader::read(const std::string &path, std::vector<char> &data) {
+	const Entry &entry = find(path);
+	data.clear();
+	data.reserve(entry.size);
+	auto sink = [&data](const char *buffer, size_t length) {
+		data.insert(data.end(), buffer, buffer + length);
+	};
+	inflate(entry, sink);
+}
+
+void Vpk::GzipBundleReader::read(const std::string &path, FileIO &out) {
+	auto sink = [&out](const char *buffer, size_t length) {
+		out.write(buffer, length);
+	};
+	inflate(find(path), sink);
+}
+
+template<typename Sink>
+void Vpk::GzipBundleReader::inflate(const Entry &entry, Sink &sink) {
+	if (entry.size == 0) return;
+
+	BlockEntry key;
+	key.compressed = 0;
+	key.offset     = entry.offset;
+	std::vector<BlockEntry>::const_iterator block = std::upper_bound(m_blocks.begin(), m_blocks.end(), key);
+	if (block == m_blocks.begin()) {
+		throw Exception("bundle index has no block for this file");
+	}
+	-- block;
+
+	m_io.seek(block->compressed, FileIO::SET);
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	int status = inflateInit2(&stream, 15 + 16);
+	if (status != Z_OK) {
+		throw Exception(zlibError("inflate", stream, status));
+	}
+
+	// inflates the blocks from there until the file is complete
+	const uint64_t end = entry.offset + entry.size;
+	uint64_t pos = block->offset;
+	char input[64 * 1024];
+	char output[64 * 1024];
+	try {
+		while (pos < end) {
+			if (stream.avail_in == 0) {
+				stream.avail_in = m_io.readSome(input, sizeof(input));
+				stream.next_in  = (Bytef*) input;
+				if (stream.avail_in == 0) {
+					throw Exception("unexpected end of bundle");
+				}
+			}
+
+			stream.next_out  = (Bytef*) output;
+			stream.avail_out = sizeof(output);
+			status = ::inflate(&stream, Z_NO_FLUSH);
+			if (status != Z_OK && status != Z_STREAM_END) {
+				throw Exception(zlibError("inflate", stream, status));
+			}
+
+			uint64_t count = sizeof(output) - stream.avail_out;
+			uint64_t first = std::max(pos, entry.offset);
+			uint64_t last  = std::min(pos + count, end);
+			if (first < last) {
+				sink(output + (first - pos), last - first);
+			}
+			pos += count;
+
+			// the next block is the next gzip member
+			if (status == Z_STREAM_END) {
+				inflateReset(&stream);
+			}
+		}
+	}
+	catch (...) {
+		inflateEnd(&stream);
+		throw;
+	}
+	inflateEnd(&stream);
+}
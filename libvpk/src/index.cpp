@@ -0,0 +1,1000 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+#include <exception>
+
+#include <boost/format.hpp>
+
+#include <vpk/index.h>
+#include <vpk/file_io.h>
+#include <vpk/buffer_reader.h>
+#include <vpk/file_format_error.h>
+#include <vpk/exception.h>
+
+const Vpk::Index::Id Vpk::Index::ROOT;
+const uint16_t       Vpk::Index::DIR_ARCHIVE;
+const size_t         Vpk::Index::RECORD_SIZE;
+const uint32_t       Vpk::Index::NO_BLOCK;
+const Vpk::Index::Entry Vpk::Index::NOT_FOUND;
+const Vpk::Index::Entry Vpk::Index::DIR_ENTRY;
+
+static const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+static const uint64_t FNV_PRIME        = 0x100000001b3ULL;
+
+// the hash table is at most half full, so probing always ends
+static const size_t   MIN_SLOTS        = 16;
+
+void Vpk::Index::clear() {
+	m_crc32.clear();
+	m_size.clear();
+	m_offset.clear();
+	m_archive.clear();
+	m_parent.clear();
+	m_name.clear();
+	m_type.clear();
+	m_preloadSize.clear();
+	m_preload.clear();
+
+	m_dirName.clear();
+	m_dirParent.clear();
+	m_dirFirst.clear();
+	m_dirHash.clear();
+
+	m_fileHash.clear();
+	rehash(0);
+
+	m_typeName.clear();
+
+	m_strings.clear();
+	m_interned.clear();
+	m_preloads.clear();
+	m_view     = 0;
+	m_viewSize = 0;
+
+	m_blocks.clear();
+	m_dirBlock.clear();
+	m_deferred      = 0;
+	m_deferredBytes = 0;
+	m_dataOffset    = 0;
+	m_archives.assign(0x10000, false);
+
+	// root directory
+	m_dirName.push_back(intern("", 0));
+	m_dirParent.push_back(ROOT);
+	m_dirBlock.push_back(NO_BLOCK);
+	m_dirHash.push_back(FNV_OFFSET_BASIS);
+}
+
+void Vpk::Index::archives(std::vector<uint16_t> &ids) const {
+	ids.clear();
+	for (size_t archive = 0, n = m_archives.size(); archive < n; ++ archive) {
+		if (m_archives[archive]) {
+			ids.push_back(archive);
+		}
+	}
+}
+
+uint32_t Vpk::Index::store(const char *str, size_t length) {
+	uint32_t pos = m_strings.size();
+	m_strings.insert(m_strings.end(), str, str + length);
+	m_strings.push_back('\0');
+	return pos;
+}
+
+// strings may be the pool itself, so the type is copied by offset
+void Vpk::Index::appendName(std::vector<char> &strings, const char *stem, size_t length, uint16_t type) const {
+	uint32_t typeName = m_typeName[type];
+	size_t   typeSize = strlen(&m_strings[typeName]) + 1;
+	strings.insert(strings.end(), stem, stem + length);
+	strings.push_back('.');
+	size_t pos = strings.size();
+	strings.resize(pos + typeSize);
+	memcpy(&strings[pos], &m_strings[typeName], typeSize);
+}
+
+uint32_t Vpk::Index::intern(const char *str, size_t length) {
+	std::string key(str, length);
+	Strings::const_iterator i = m_interned.find(key);
+	if (i != m_interned.end()) {
+		return i->second;
+	}
+
+	uint32_t pos = store(str, length);
+	m_interned[key] = pos;
+	return pos;
+}
+
+uint16_t Vpk::Index::addType(const std::string &type) {
+	uint32_t name = intern(type.c_str(), type.size());
+
+	// there are only a handful of types per package
+	for (size_t i = 0, n = m_typeName.size(); i < n; ++ i) {
+		if (m_typeName[i] == name) {
+			return i;
+		}
+	}
+
+	if (m_typeName.size() > 0xFFFF) {
+		throw FileFormatError("too many file types");
+	}
+	m_typeName.push_back(name);
+	return m_typeName.size() - 1;
+}
+
+std::string Vpk::Index::dirPath(Id dir) const {
+	std::vector<const char*> names;
+	for (; dir != ROOT; dir = m_dirParent[dir]) {
+		names.push_back(dirName(dir));
+	}
+
+	std::string path;
+	for (std::vector<const char*>::const_reverse_iterator i = names.rbegin(); i != names.rend(); ++ i) {
+		if (!path.empty()) path += '/';
+		path += *i;
+	}
+	return path;
+}
+
+std::string Vpk::Index::path(Id file) const {
+	std::string path = dirPath(m_parent[file]);
+	if (!path.empty()) path += '/';
+	path += name(file);
+	return path;
+}
+
+void Vpk::Index::dirPaths(std::vector<std::string> &paths) const {
+	paths.resize(dirs());
+	paths[ROOT].clear();
+	for (Id dir = ROOT + 1; dir < dirs(); ++ dir) {
+		const std::string &parent = paths[m_dirParent[dir]];
+		std::string &path = paths[dir];
+		path = parent;
+		if (!path.empty()) path += '/';
+		path += dirName(dir);
+	}
+}
+
+Vpk::Index::Id Vpk::Index::mkdir(const char *path) {
+	Id dir = ROOT;
+	const char *ptr = path;
+	while (*ptr == '/') ++ ptr;
+	while (*ptr) {
+		const char *slash = strchr(ptr, '/');
+		size_t length = slash ? slash - ptr : strlen(ptr);
+
+		dir = mkdir(dir, ptr, length);
+
+		if (!slash) break;
+		ptr = slash + 1;
+		while (*ptr == '/') ++ ptr;
+	}
+	return dir;
+}
+
+Vpk::Index::Id Vpk::Index::mkdir(Id parent, const char *name, size_t length) {
+	uint64_t state = key(childHash(parent), name, length);
+	uint32_t code  = fold(state);
+	size_t   mask  = m_slots.size() - 1;
+	for (size_t slot = code & mask; m_slots[slot].entry != NOT_FOUND; slot = (slot + 1) & mask) {
+		Entry entry = m_slots[slot].entry;
+		if (m_slots[slot].code == code && isDir(entry)) {
+			Id dir = entryId(entry);
+			const char *dirname = dirName(dir);
+			if (m_dirParent[dir] == parent && strncmp(dirname, name, length) == 0 && dirname[length] == '\0') {
+				return dir;
+			}
+		}
+	}
+
+	Id dir = m_dirName.size();
+	m_dirName.push_back(intern(name, length));
+	m_dirParent.push_back(parent);
+	m_dirBlock.push_back(NO_BLOCK);
+	m_dirHash.push_back(state);
+	insert(DIR_ENTRY | dir);
+	return dir;
+}
+
+uint64_t Vpk::Index::hash(uint64_t state, const char *str, size_t length) {
+	for (const char *end = str + length; str < end; ++ str) {
+		state ^= (unsigned char) *str;
+		state *= FNV_PRIME;
+	}
+	return state;
+}
+
+// folds eight ASCII letters to lower case at once, other bytes are kept
+static inline uint64_t lower(uint64_t word) {
+	uint64_t ascii  = ~word & 0x8080808080808080ULL;
+	uint64_t bits   = word  & 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t aboveZ = bits + 0x2525252525252525ULL;
+	uint64_t fromA  = bits + 0x3f3f3f3f3f3f3f3fULL;
+	return word | ((ascii & (fromA ^ aboveZ)) >> 2);
+}
+
+static inline unsigned char lower(unsigned char c) {
+	return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+uint64_t Vpk::Index::hashLower(uint64_t state, const char *str, size_t length) {
+	const char *end = str + length;
+	for (; end - str >= 8; str += 8) {
+		uint64_t word;
+		unsigned char bytes[8];
+		memcpy(&word, str, 8);
+		word = lower(word);
+		memcpy(bytes, &word, 8);
+		for (size_t i = 0; i < 8; ++ i) {
+			state ^= bytes[i];
+			state *= FNV_PRIME;
+		}
+	}
+	for (; str < end; ++ str) {
+		state ^= lower((unsigned char) *str);
+		state *= FNV_PRIME;
+	}
+	return state;
+}
+
+bool Vpk::Index::equalsLower(const char *a, const char *b, size_t length) {
+	const char *end = a + length;
+	for (; end - a >= 8; a += 8, b += 8) {
+		uint64_t x, y;
+		memcpy(&x, a, 8);
+		memcpy(&y, b, 8);
+		if (x != y && lower(x) != lower(y)) {
+			return false;
+		}
+	}
+	for (; a < end; ++ a, ++ b) {
+		if (lower((unsigned char) *a) != lower((unsigned char) *b)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+uint64_t Vpk::Index::childHash(Id dir) const {
+	return dir == ROOT ? FNV_OFFSET_BASIS : hash(m_dirHash[dir], "/", 1);
+}
+
+uint32_t Vpk::Index::fileHash(Id dir, const char *name, size_t length) const {
+	return fold(key(childHash(dir), name, length));
+}
+
+// compares the path of entry from its last component upwards
+bool Vpk::Index::matches(Entry entry, const char *path, size_t length) const {
+	size_t end = length;
+	Id dir = entryId(entry);
+
+	if (!isDir(entry)) {
+		Id file = dir;
+		const char *name = this->name(file);
+		size_t namelen = strlen(name);
+		if (end < namelen || !equals(path + end - namelen, name, namelen)) {
+			return false;
+		}
+		end -= namelen;
+		dir = m_parent[file];
+		if (dir != ROOT && (end == 0 || path[-- end] != '/')) {
+			return false;
+		}
+	}
+
+	while (dir != ROOT) {
+		const char *name = dirName(dir);
+		size_t namelen = strlen(name);
+		if (end < namelen || !equals(path + end - namelen, name, namelen)) {
+			return false;
+		}
+		end -= namelen;
+		dir = m_dirParent[dir];
+		if (dir != ROOT && (end == 0 || path[-- end] != '/')) {
+			return false;
+		}
+	}
+
+	return end == 0;
+}
+
+Vpk::Index::Entry Vpk::Index::find(const char *path, size_t length) const {
+	if (length == 0) {
+		return DIR_ENTRY | ROOT;
+	}
+
+	uint32_t code = fold(key(FNV_OFFSET_BASIS, path, length));
+	size_t   mask = m_slots.size() - 1;
+	for (size_t slot = code & mask; m_slots[slot].entry != NOT_FOUND; slot = (slot + 1) & mask) {
+		Entry entry = m_slots[slot].entry;
+		if (m_slots[slot].code == code && matches(entry, path, length)) {
+			return entry;
+		}
+	}
+	return NOT_FOUND;
+}
+
+// in case insensitive mode more than one directory can match
+Vpk::Index::Id Vpk::Index::findPending(const char *path, size_t length) const {
+	if (length == 0) {
+		return pending(ROOT) ? ROOT : NOT_FOUND;
+	}
+
+	uint32_t code = fold(key(FNV_OFFSET_BASIS, path, length));
+	size_t   mask = m_slots.size() - 1;
+	for (size_t slot = code & mask; m_slots[slot].entry != NOT_FOUND; slot = (slot + 1) & mask) {
+		Entry entry = m_slots[slot].entry;
+		if (m_slots[slot].code == code && isDir(entry) && pending(entryId(entry)) &&
+			matches(entry, path, length)) {
+			return entryId(entry);
+		}
+	}
+	return NOT_FOUND;
+}
+
+void Vpk::Index::insert(Entry entry) {
+	// the root directory is not in the table
+	size_t entries = files() + dirs() - 1;
+	if (entries * 2 > m_slots.size()) {
+		rehash(entries);
+		return;
+	}
+
+	uint32_t code = entryHash(entry);
+	size_t   mask = m_slots.size() - 1;
+	size_t   slot = code & mask;
+	for (; m_slots[slot].entry != NOT_FOUND; slot = (slot + 1) & mask) {
+		Entry other = m_slots[slot].entry;
+
+		// a file that occurs more than once replaces the earlier one
+		if (m_slots[slot].code == code && !isDir(entry) && !isDir(other)) {
+			Id file = entryId(entry);
+			if (m_parent[other] == m_parent[file] && m_type[other] == m_type[file] &&
+				strcmp(name(other), name(file)) == 0) {
+				break;
+			}
+		}
+	}
+	m_slots[slot].code  = code;
+	m_slots[slot].entry = entry;
+}
+
+void Vpk::Index::setIcase(bool icase) {
+	if (icase != m_icase) {
+		m_icase = icase;
+		rehashAll();
+	}
+}
+
+// recomputes all hash codes, parents come before their children
+void Vpk::Index::rehashAll() {
+	for (Id dir = ROOT + 1, n = dirs(); dir < n; ++ dir) {
+		const char *name = dirName(dir);
+		m_dirHash[dir] = key(childHash(m_dirParent[dir]), name, strlen(name));
+	}
+	for (Id file = 0, n = files(); file < n; ++ file) {
+		const char *name = this->name(file);
+		m_fileHash[file] = fileHash(m_parent[file], name, strlen(name));
+	}
+	rehash(files() + dirs() - 1);
+}
+
+// reinserts everything in id order, so the last of duplicate files wins
+void Vpk::Index::rehash(size_t entries) {
+	size_t capacity = MIN_SLOTS;
+	while (capacity < entries * 2) {
+		capacity *= 2;
+	}
+	Slot empty = { 0, NOT_FOUND };
+	m_slots.assign(capacity, empty);
+
+	for (Id dir = ROOT + 1, n = dirs(); dir < n; ++ dir) {
+		insert(DIR_ENTRY | dir);
+	}
+	for (Id file = 0, n = files(); file < n; ++ file) {
+		insert(file);
+	}
+}
+
+Vpk::Index::Id Vpk::Index::add(Id dir, const char *name, size_t length, uint16_t type, const char *record) {
+	if (BufferReader::loadLU16(record + 16) != 0xFFFF) {
+		throw FileFormatError("invalid terminator");
+	}
+
+	Id file = m_crc32.size();
+	uint16_t archive = BufferReader::loadLU16(record + 6);
+	uint32_t pos     = m_strings.size();
+	appendName(m_strings, name, length, type);
+	uint32_t code    = fileHash(dir, &m_strings[pos], m_strings.size() - pos - 1);
+
+	if (!m_dirFirst.empty()) {
+		m_dirFirst.clear();
+	}
+
+	m_crc32.push_back(BufferReader::loadLU32(record));
+	m_preloadSize.push_back(BufferReader::loadLU16(record + 4));
+	m_archive.push_back(archive);
+	m_offset.push_back(BufferReader::loadLU32(record + 8));
+	m_size.push_back(BufferReader::loadLU32(record + 12));
+	m_preload.push_back(m_preloads.size());
+	m_parent.push_back(dir);
+	m_name.push_back(pos);
+	m_type.push_back(type);
+	m_fileHash.push_back(code);
+	m_archives[archive] = true;
+	insert(file);
+
+	return file;
+}
+
+void Vpk::Index::read(FileIO &io, Id dir, const std::string &type) {
+	uint16_t typeId = addType(type);
+	std::string name;
+	char record[RECORD_SIZE];
+	for (;;) {
+		name.clear();
+		io.readAsciiZ(name);
+		if (name.empty()) break;
+
+		io.read(record, sizeof(record));
+		Id file = add(dir, name.c_str(), name.size(), typeId, record);
+
+		size_t length = m_preloadSize[file];
+		if (length > 0) {
+			size_t pos = m_preloads.size();
+			m_preloads.resize(pos + length);
+			io.read(&m_preloads[pos], length);
+		}
+	}
+}
+
+void Vpk::Index::read(BufferReader &reader, Id dir, const std::string &type) {
+	m_view     = reader.data() - reader.tell();
+	m_viewSize = reader.size();
+	readBlock(reader, dir, addType(type));
+}
+
+void Vpk::Index::readBlock(BufferReader &reader, Id dir, uint16_t type) {
+	for (;;) {
+		size_t length = 0;
+		const char *name = reader.readAsciiZ(length);
+		if (length == 0) break;
+
+		// the fixed part of the record is loaded in one go
+		Id file = add(dir, name, length, type, reader.skip(RECORD_SIZE));
+
+		// preload bytes stay where they are
+		m_preload[file] = reader.tell();
+		reader.skip(m_preloadSize[file]);
+	}
+}
+
+void Vpk::Index::defer(BufferReader &reader, Id dir, const std::string &type) {
+	m_view     = reader.data() - reader.tell();
+	m_viewSize = reader.size();
+
+	Block block;
+	block.offset  = reader.tell();
+	block.records = 0;
+	block.bytes   = 0;
+	block.type    = addType(type);
+	// stem + '.' + type + '\0'
+	size_t typeSize = strlen(&m_strings[m_typeName[block.type]]) + 2;
+
+	for (;;) {
+		size_t length = 0;
+		reader.readAsciiZ(length);
+		if (length == 0) break;
+
+		const char *record = reader.skip(RECORD_SIZE);
+		if (BufferReader::loadLU16(record + 16) != 0xFFFF) {
+			throw FileFormatError("invalid terminator");
+		}
+		m_archives[BufferReader::loadLU16(record + 6)] = true;
+		reader.skip(BufferReader::loadLU16(record + 4));
+		++ block.records;
+		block.bytes += length + typeSize;
+	}
+
+	if (block.records > 0) {
+		block.next = m_dirBlock[dir];
+		m_dirBlock[dir] = m_blocks.size();
+		m_blocks.push_back(block);
+		m_deferred += block.records;
+		m_deferredBytes += block.bytes;
+	}
+}
+
+void Vpk::Index::load(Id dir) {
+	// blocks are chained newest first
+	std::vector<uint32_t> blocks;
+	for (uint32_t block = m_dirBlock[dir]; block != NO_BLOCK; block = m_blocks[block].next) {
+		blocks.push_back(block);
+	}
+	m_dirBlock[dir] = NO_BLOCK;
+
+	Id first = files();
+	BufferReader reader(m_view, m_viewSize);
+	for (std::vector<uint32_t>::const_reverse_iterator i = blocks.rbegin(); i != blocks.rend(); ++ i) {
+		const Block &block = m_blocks[*i];
+		reader.seek(block.offset, FileIO::SET);
+		readBlock(reader, dir, block.type);
+		m_deferred -= block.records;
+		m_deferredBytes -= block.bytes;
+	}
+	relocate(first, files());
+
+	if (m_deferred == 0) {
+		m_blocks.clear();
+	}
+}
+
+void Vpk::Index::reserve() {
+	size_t files = m_crc32.size() + m_deferred;
+	m_crc32.reserve(files);
+	m_size.reserve(files);
+	m_offset.reserve(files);
+	m_archive.reserve(files);
+	m_parent.reserve(files);
+	m_name.reserve(files);
+	m_type.reserve(files);
+	m_preloadSize.reserve(files);
+	m_preload.reserve(files);
+	m_fileHash.reserve(files);
+	m_strings.reserve(m_strings.size() + m_deferredBytes);
+}
+
+// The blocks are visited in directory order. The number of records of
+// each block is known, so every worker writes its own range of files
+// without any locking. Only the names go to a private string chunk that
+// is appended to the pool afterwards.
+void Vpk::Index::loadAll(unsigned int threads) {
+	if (!pending()) return;
+
+	std::vector<Pending> pending;
+	Id first = files();
+	Id next  = first;
+	for (Id dir = ROOT, n = dirs(); dir < n; ++ dir) {
+		size_t start = pending.size();
+		for (uint32_t block = m_dirBlock[dir]; block != NO_BLOCK; block = m_blocks[block].next) {
+			Pending item = { block, dir, 0 };
+			pending.push_back(item);
+		}
+		// blocks are chained newest first
+		std::reverse(pending.begin() + start, pending.end());
+		for (size_t i = start; i < pending.size(); ++ i) {
+			pending[i].file = next;
+			next += m_blocks[pending[i].block].records;
+		}
+		m_dirBlock[dir] = NO_BLOCK;
+	}
+	Id last = next;
+
+	m_crc32.resize(last);
+	m_size.resize(last);
+	m_offset.resize(last);
+	m_archive.resize(last);
+	m_parent.resize(last);
+	m_name.resize(last);
+	m_type.resize(last);
+	m_preloadSize.resize(last);
+	m_preload.resize(last);
+	m_fileHash.resize(last);
+
+	// small indices are not worth a thread
+	static const size_t MIN_RECORDS = 16384;
+	size_t records = last - first;
+	if (threads > records / MIN_RECORDS) {
+		threads = records / MIN_RECORDS;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+
+	// split into ranges of about the same number of records
+	std::vector<size_t> bounds(1, 0);
+	for (size_t i = 0, n = pending.size(); i < n && bounds.size() < threads; ++ i) {
+		if ((pending[i].file - first) * threads >= records * bounds.size()) {
+			if (i > bounds.back()) bounds.push_back(i);
+		}
+	}
+	bounds.push_back(pending.size());
+
+	size_t chunks = bounds.size() - 1;
+	std::vector< std::vector<char> > strings(chunks);
+	std::vector<std::exception_ptr> errors(chunks);
+	std::vector<std::thread> workers;
+	for (size_t chunk = 1; chunk < chunks; ++ chunk) {
+		workers.push_back(std::thread([&, chunk]() {
+			try {
+				decode(pending, bounds[chunk], bounds[chunk + 1], strings[chunk]);
+			}
+			catch (...) {
+				errors[chunk] = std::current_exception();
+			}
+		}));
+	}
+	try {
+		decode(pending, bounds[0], bounds[1], strings[0]);
+	}
+	catch (...) {
+		errors[0] = std::current_exception();
+	}
+	for (std::vector<std::thread>::iterator i = workers.begin(); i != workers.end(); ++ i) {
+		i->join();
+	}
+	for (size_t chunk = 0; chunk < chunks; ++ chunk) {
+		if (errors[chunk]) {
+			std::rethrow_exception(errors[chunk]);
+		}
+	}
+
+	for (size_t chunk = 0; chunk < chunks; ++ chunk) {
+		uint32_t base = m_strings.size();
+		m_strings.insert(m_strings.end(), strings[chunk].begin(), strings[chunk].end());
+		Id end = bounds[chunk + 1] < pending.size() ? pending[bounds[chunk + 1]].file : last;
+		for (Id file = pending[bounds[chunk]].file; file < end; ++ file) {
+			m_name[file] += base;
+		}
+	}
+
+	m_blocks.clear();
+	m_deferred = 0;
+	m_deferredBytes = 0;
+
+	if (first == 0) {
+		m_dirFirst.assign(dirs() + 1, 0);
+		for (Id file = 0; file < last; ++ file) {
+			++ m_dirFirst[m_parent[file] + 1];
+		}
+		for (Id dir = 0, n = dirs(); dir < n; ++ dir) {
+			m_dirFirst[dir + 1] += m_dirFirst[dir];
+		}
+	}
+	else {
+		m_dirFirst.clear();
+	}
+
+	size_t entries = last + dirs() - 1;
+	if (entries * 2 > m_slots.size()) {
+		rehash(entries);
+	}
+	else {
+		for (Id file = first; file < last; ++ file) {
+			insert(file);
+		}
+	}
+}
+
+// runs concurrently, so it only writes the files of its own blocks
+void Vpk::Index::decode(const std::vector<Pending> &pending, size_t begin, size_t end, std::vector<char> &strings) {
+	BufferReader reader(m_view, m_viewSize);
+	uint32_t dataOffset = m_dataOffset;
+	for (size_t i = begin; i < end; ++ i) {
+		const Block &block = m_blocks[pending[i].block];
+		Id dir  = pending[i].dir;
+		Id file = pending[i].file;
+		reader.seek(block.offset, FileIO::SET);
+		for (Id last = file + block.records; file < last; ++ file) {
+			size_t length = 0;
+			const char *name = reader.readAsciiZ(length);
+			const char *record = reader.skip(RECORD_SIZE);
+			uint16_t archive = BufferReader::loadLU16(record + 6);
+			uint32_t offset  = BufferReader::loadLU32(record + 8);
+
+			m_crc32[file]       = BufferReader::loadLU32(record);
+			m_preloadSize[file] = BufferReader::loadLU16(record + 4);
+			m_archive[file]     = archive;
+			m_offset[file]      = archive == DIR_ARCHIVE ? offset + dataOffset : offset;
+			m_size[file]        = BufferReader::loadLU32(record + 12);
+			m_preload[file]     = reader.tell();
+			m_parent[file]      = dir;
+			m_name[file]        = strings.size();
+			m_type[file]        = block.type;
+
+			appendName(strings, name, length, block.type);
+			m_fileHash[file]    = fileHash(dir, &strings[m_name[file]], strings.size() - m_name[file] - 1);
+			reader.skip(m_preloadSize[file]);
+		}
+	}
+}
+
+void Vpk::Index::relocate(uint32_t dataOffset) {
+	m_dataOffset = dataOffset;
+	relocate(0, files());
+}
+
+void Vpk::Index::relocate(Id first, Id last) {
+	uint32_t dataOffset = m_dataOffset;
+	for (Id file = first; file < last; ++ file) {
+		if (m_archive[file] == DIR_ARCHIVE) {
+			m_offset[file] += dataOffset;
+		}
+	}
+}
+
+template<typename T>
+static void compact(std::vector<T> &values, const std::vector<bool> &keep) {
+	size_t j = 0;
+	for (size_t i = 0, n = values.size(); i < n; ++ i) {
+		if (keep[i]) {
+			values[j ++] = values[i];
+		}
+	}
+	values.resize(j);
+}
+
+void Vpk::Index::retain(const std::vector<bool> &keepFiles, const std::vector<bool> &keepDirs) {
+	// kept directories keep all their subdirectories
+	std::vector<bool> dirs(keepDirs);
+	for (Id dir = ROOT + 1, n = this->dirs(); dir < n; ++ dir) {
+		if (dirs[m_dirParent[dir]]) {
+			dirs[dir] = true;
+		}
+	}
+
+	const std::vector<bool> &files = keepFiles;
+	for (Id file = 0, n = this->files(); file < n; ++ file) {
+		if (files[file]) {
+			dirs[m_parent[file]] = true;
+		}
+	}
+
+	// and directories containing anything kept survive too
+	for (Id dir = this->dirs(); dir -- > ROOT + 1;) {
+		if (dirs[dir]) {
+			dirs[m_dirParent[dir]] = true;
+		}
+	}
+	dirs[ROOT] = true;
+
+	std::vector<Id> remap(this->dirs(), ROOT);
+	for (Id dir = 0, next = 0, n = this->dirs(); dir < n; ++ dir) {
+		if (dirs[dir]) {
+			remap[dir] = next ++;
+		}
+	}
+
+	for (Id file = 0, n = this->files(); file < n; ++ file) {
+		m_parent[file] = remap[m_parent[file]];
+	}
+	for (Id dir = 0, n = this->dirs(); dir < n; ++ dir) {
+		m_dirParent[dir] = remap[m_dirParent[dir]];
+	}
+
+	compact(m_crc32,       files);
+	compact(m_size,        files);
+	compact(m_offset,      files);
+	compact(m_archive,     files);
+	compact(m_parent,      files);
+	compact(m_name,        files);
+	compact(m_type,        files);
+	compact(m_preloadSize, files);
+	compact(m_preload,     files);
+	compact(m_fileHash,    files);
+
+	compact(m_dirName,   dirs);
+	compact(m_dirParent, dirs);
+	compact(m_dirHash,   dirs);
+
+	m_blocks.clear();
+	m_dirBlock.assign(this->dirs(), NO_BLOCK);
+	m_deferred = 0;
+	m_deferredBytes = 0;
+
+	m_archives.assign(0x10000, false);
+	for (Id file = 0, n = this->files(); file < n; ++ file) {
+		m_archives[m_archive[file]] = true;
+	}
+
+	if (grouped()) {
+		group();
+	}
+	else {
+		rehash(this->files() + this->dirs() - 1);
+	}
+}
+
+bool Vpk::Index::shadowed(std::vector<bool> &files) const {
+	files.assign(this->files(), true);
+	size_t found = 0;
+	for (std::vector<Slot>::const_iterator slot = m_slots.begin(); slot != m_slots.end(); ++ slot) {
+		if (slot->entry != NOT_FOUND && !isDir(slot->entry)) {
+			files[entryId(slot->entry)] = false;
+			++ found;
+		}
+	}
+	return found < this->files();
+}
+
+template<typename T>
+static void permute(std::vector<T> &values, const std::vector<Vpk::Index::Id> &order) {
+	std::vector<T> sorted(order.size());
+	for (size_t i = 0, n = order.size(); i < n; ++ i) {
+		sorted[i] = values[order[i]];
+	}
+	values.swap(sorted);
+}
+
+void Vpk::Index::group() {
+	std::vector<Id> first(dirs() + 1, 0);
+	for (Id file = 0, n = files(); file < n; ++ file) {
+		++ first[m_parent[file] + 1];
+	}
+	for (Id dir = 0, n = dirs(); dir < n; ++ dir) {
+		first[dir + 1] += first[dir];
+	}
+
+	// stable counting sort
+	std::vector<Id> next(first.begin(), first.end() - 1);
+	std::vector<Id> order(files());
+	for (Id file = 0, n = files(); file < n; ++ file) {
+		order[next[m_parent[file]] ++] = file;
+	}
+
+	permute(m_crc32,       order);
+	permute(m_size,        order);
+	permute(m_offset,      order);
+	permute(m_archive,     order);
+	permute(m_parent,      order);
+	permute(m_name,        order);
+	permute(m_type,        order);
+	permute(m_preloadSize, order);
+	permute(m_preload,     order);
+	permute(m_fileHash,    order);
+
+	m_dirFirst.swap(first);
+	rehash(files() + dirs() - 1);
+}
+
+// arrays are padded so that each of them is 8 byte aligned
+template<typename T>
+static void save(Vpk::FileIO &io, const std::vector<T> &values) {
+	static const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	size_t size = values.size() * sizeof(T);
+	if (size > 0) {
+		io.write((const char*) &values[0], size);
+	}
+	size_t pad = (8 - size % 8) % 8;
+	if (pad > 0) {
+		io.write(padding, pad);
+	}
+}
+
+template<typename T>
+static void restore(Vpk::BufferReader &reader, std::vector<T> &values, size_t count) {
+	size_t size = count * sizeof(T);
+	values.resize(count);
+	if (size > 0) {
+		memcpy(&values[0], reader.skip(size), size);
+	}
+	reader.skip((8 - size % 8) % 8);
+}
+
+void Vpk::Index::save(FileIO &io) {
+	if (pending() || !m_preloads.empty()) {
+		throw Exception("only complete indices referencing their preload data can be saved");
+	}
+	group();
+
+	std::vector<uint32_t> counts;
+	counts.push_back(files());
+	counts.push_back(dirs());
+	counts.push_back(m_typeName.size());
+	counts.push_back(m_strings.size());
+	counts.push_back(m_slots.size());
+	counts.push_back(m_icase);
+
+	::save(io, counts);
+	::save(io, m_crc32);
+	::save(io, m_size);
+	::save(io, m_offset);
+	::save(io, m_archive);
+	::save(io, m_parent);
+	::save(io, m_name);
+	::save(io, m_type);
+	::save(io, m_preloadSize);
+	::save(io, m_preload);
+	::save(io, m_fileHash);
+	::save(io, m_dirName);
+	::save(io, m_dirParent);
+	::save(io, m_dirFirst);
+	::save(io, m_dirHash);
+	::save(io, m_typeName);
+	::save(io, m_strings);
+	::save(io, m_slots);
+}
+
+void Vpk::Index::restore(BufferReader &reader, const char *view, size_t viewSize) {
+	clear();
+
+	std::vector<uint32_t> counts;
+	::restore(reader, counts, 6);
+	size_t files   = counts[0];
+	size_t dirs    = counts[1];
+	size_t types   = counts[2];
+	size_t strings = counts[3];
+	size_t slots   = counts[4];
+
+	::restore(reader, m_crc32,       files);
+	::restore(reader, m_size,        files);
+	::restore(reader, m_offset,      files);
+	::restore(reader, m_archive,     files);
+	::restore(reader, m_parent,      files);
+	::restore(reader, m_name,        files);
+	::restore(reader, m_type,        files);
+	::restore(reader, m_preloadSize, files);
+	::restore(reader, m_preload,     files);
+	::restore(reader, m_fileHash,    files);
+	::restore(reader, m_dirName,     dirs);
+	::restore(reader, m_dirParent,   dirs);
+	::restore(reader, m_dirFirst,    dirs + 1);
+	::restore(reader, m_dirHash,     dirs);
+	::restore(reader, m_typeName,    types);
+	::restore(reader, m_strings,     strings);
+	::restore(reader, m_slots,       slots);
+
+	// never trust offsets read from a file
+	bool valid = dirs > 0 && strings > 0 && m_strings[strings - 1] == '\0' &&
+		m_dirFirst[0] == 0 && m_dirFirst[dirs] == files &&
+		slots >= MIN_SLOTS && slots >= 2 * (files + dirs - 1) && (slots & (slots - 1)) == 0;
+	size_t used = 0;
+	for (size_t slot = 0; valid && slot < slots; ++ slot) {
+		Entry entry = m_slots[slot].entry;
+		if (entry != NOT_FOUND) {
+			valid = isDir(entry) ?
+				entryId(entry) != ROOT && entryId(entry) < dirs :
+				entryId(entry) < files;
+			++ used;
+		}
+	}
+	// a table without a free slot would make lookups probe forever
+	valid = valid && used <= files + dirs - 1;
+	for (Id type = 0; valid && type < types; ++ type) {
+		valid = m_typeName[type] < strings;
+	}
+	for (Id dir = 0; valid && dir < dirs; ++ dir) {
+		valid = m_dirName[dir] < strings &&
+			(dir == ROOT || m_dirParent[dir] < dir) &&
+			m_dirFirst[dir] <= m_dirFirst[dir + 1];
+		for (Id file = m_dirFirst[dir]; valid && file < m_dirFirst[dir + 1]; ++ file) {
+			valid = m_parent[file] == dir && m_name[file] < strings && m_type[file] < types &&
+				(size_t) m_preload[file] + m_preloadSize[file] <= viewSize;
+		}
+	}
+	if (!valid) {
+		clear();
+		throw FileFormatError("inconsistent index data");
+	}
+
+	m_view     = view;
+	m_viewSize = viewSize;
+	m_dirBlock.assign(dirs, NO_BLOCK);
+
+	for (Id file = 0; file < files; ++ file) {
+		m_archives[m_archive[file]] = true;
+	}
+
+	// the hash codes depend on the lookup mode
+	if ((counts[5] != 0) != m_icase) {
+		rehashAll();
+	}
+}
@@ -0,0 +1,85 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <vpk/mapped_file.h>
+#include <vpk/io_error.h>
+
+void Vpk::MappedFile::open(const char *filename) {
+	close();
+
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) {
+		throw IOError(errno);
+	}
+
+	struct stat stbuf;
+	if (fstat(fd, &stbuf) != 0) {
+		int errnum = errno;
+		::close(fd);
+		throw IOError(errnum);
+	}
+
+	if (!S_ISREG(stbuf.st_mode)) {
+		::close(fd);
+		throw IOError(ENODEV);
+	}
+
+	// mmap() of an empty file fails with EINVAL, but an empty file is
+	// still a valid (truncated) input, so map it as a zero length buffer
+	if (stbuf.st_size == 0) {
+		::close(fd);
+		m_data = "";
+		m_size = 0;
+		return;
+	}
+
+	void *data = mmap(NULL, stbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	int errnum = errno;
+	::close(fd);
+	if (data == MAP_FAILED) {
+		throw IOError(errnum);
+	}
+
+	// the index is parsed front to back exactly once
+	madvise(data, stbuf.st_size, MADV_SEQUENTIAL);
+
+	m_data = (const char*) data;
+	m_size = stbuf.st_size;
+}
+
+void Vpk::MappedFile::close() {
+	if (m_data) {
+		if (m_size > 0) {
+			munmap((void*) m_data, m_size);
+		}
+		m_data = 0;
+		m_size = 0;
+	}
+}
+
+void Vpk::MappedFile::advise(int advice) {
+	if (m_size > 0) {
+		madvise((void*) m_data, m_size, advice);
+	}
+}
@@ -0,0 +1,192 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <endian.h>
+
+#include <algorithm>
+
+#include <boost/format.hpp>
+
+#include <vpk/md5.h>
+
+const size_t Vpk::Md5::DIGEST_SIZE;
+const size_t Vpk::Md5::BLOCK_SIZE;
+
+std::string Vpk::Md5::Digest::str() const {
+	std::string hex;
+	for (size_t i = 0; i < DIGEST_SIZE; ++ i) {
+		hex += (boost::format("%02x") % (unsigned int) bytes[i]).str();
+	}
+	return hex;
+}
+
+void Vpk::Md5::reset() {
+	m_state[0] = 0x67452301;
+	m_state[1] = 0xefcdab89;
+	m_state[2] = 0x98badcfe;
+	m_state[3] = 0x10325476;
+	m_length   = 0;
+}
+
+void Vpk::Md5::process(const char *buffer, size_t length) {
+	const unsigned char *data = (const unsigned char*) buffer;
+	size_t used = m_length % BLOCK_SIZE;
+	m_length += length;
+
+	if (used > 0) {
+		size_t count = std::min(length, BLOCK_SIZE - used);
+		memcpy(m_buffer + used, data, count);
+		data   += count;
+		length -= count;
+		if (used + count < BLOCK_SIZE) return;
+		transform(m_buffer, 1);
+	}
+
+	// whole blocks are hashed straight from the input
+	size_t blocks = length / BLOCK_SIZE;
+	if (blocks > 0) {
+		transform(data, blocks);
+		data   += blocks * BLOCK_SIZE;
+		length -= blocks * BLOCK_SIZE;
+	}
+
+	memcpy(m_buffer, data, length);
+}
+
+Vpk::Md5::Digest Vpk::Md5::digest() const {
+	Md5 md5(*this);
+
+	unsigned char padding[BLOCK_SIZE * 2] = { 0x80 };
+	size_t used = m_length % BLOCK_SIZE;
+	size_t pad  = (used < 56 ? 56 : 120) - used;
+	uint64_t bits = htole64(m_length * 8);
+	memcpy(padding + pad, &bits, sizeof(bits));
+	md5.process((const char*) padding, pad + sizeof(bits));
+
+	Digest digest;
+	for (size_t i = 0; i < 4; ++ i) {
+		uint32_t word = htole32(md5.m_state[i]);
+		memcpy(digest.bytes + i * 4, &word, sizeof(word));
+	}
+	return digest;
+}
+
+#define MD5_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+
+#define MD5_STEP(f, a, b, c, d, x, t, s) \
+	(a) += f((b), (c), (d)) + (x) + (t); \
+	(a)  = (((a) << (s)) | ((a) >> (32 - (s)))) + (b);
+
+// the state stays in registers for all blocks
+void Vpk::Md5::transform(const unsigned char *blocks, size_t count) {
+	uint32_t a = m_state[0];
+	uint32_t b = m_state[1];
+	uint32_t c = m_state[2];
+	uint32_t d = m_state[3];
+
+	for (const unsigned char *block = blocks, *end = blocks + count * BLOCK_SIZE; block < end; block += BLOCK_SIZE) {
+		uint32_t x[16];
+		memcpy(x, block, sizeof(x));
+		for (size_t i = 0; i < 16; ++ i) {
+			x[i] = le32toh(x[i]);
+		}
+
+		uint32_t aa = a, bb = b, cc = c, dd = d;
+
+		MD5_STEP(MD5_F, a, b, c, d, x[ 0], 0xd76aa478,  7)
+		MD5_STEP(MD5_F, d, a, b, c, x[ 1], 0xe8c7b756, 12)
+		MD5_STEP(MD5_F, c, d, a, b, x[ 2], 0x242070db, 17)
+		MD5_STEP(MD5_F, b, c, d, a, x[ 3], 0xc1bdceee, 22)
+		MD5_STEP(MD5_F, a, b, c, d, x[ 4], 0xf57c0faf,  7)
+		MD5_STEP(MD5_F, d, a, b, c, x[ 5], 0x4787c62a, 12)
+		MD5_STEP(MD5_F, c, d, a, b, x[ 6], 0xa8304613, 17)
+		MD5_STEP(MD5_F, b, c, d, a, x[ 7], 0xfd469501, 22)
+		MD5_STEP(MD5_F, a, b, c, d, x[ 8], 0x698098d8,  7)
+		MD5_STEP(MD5_F, d, a, b, c, x[ 9], 0x8b44f7af, 12)
+		MD5_STEP(MD5_F, c, d, a, b, x[10], 0xffff5bb1, 17)
+		MD5_STEP(MD5_F, b, c, d, a, x[11], 0x895cd7be, 22)
+		MD5_STEP(MD5_F, a, b, c, d, x[12], 0x6b901122,  7)
+		MD5_STEP(MD5_F, d, a, b, c, x[13], 0xfd987193, 12)
+		MD5_STEP(MD5_F, c, d, a, b, x[14], 0xa679438e, 17)
+		MD5_STEP(MD5_F, b, c, d, a, x[15], 0x49b40821, 22)
+
+		MD5_STEP(MD5_G, a, b, c, d, x[ 1], 0xf61e2562,  5)
+		MD5_STEP(MD5_G, d, a, b, c, x[ 6], 0xc040b340,  9)
+		MD5_STEP(MD5_G, c, d, a, b, x[11], 0x265e5a51, 14)
+		MD5_STEP(MD5_G, b, c, d, a, x[ 0], 0xe9b6c7aa, 20)
+		MD5_STEP(MD5_G, a, b, c, d, x[ 5], 0xd62f105d,  5)
+		MD5_STEP(MD5_G, d, a, b, c, x[10], 0x02441453,  9)
+		MD5_STEP(MD5_G, c, d, a, b, x[15], 0xd8a1e681, 14)
+		MD5_STEP(MD5_G, b, c, d, a, x[ 4], 0xe7d3fbc8, 20)
+		MD5_STEP(MD5_G, a, b, c, d, x[ 9], 0x21e1cde6,  5)
+		MD5_STEP(MD5_G, d, a, b, c, x[14], 0xc33707d6,  9)
+		MD5_STEP(MD5_G, c, d, a, b, x[ 3], 0xf4d50d87, 14)
+		MD5_STEP(MD5_G, b, c, d, a, x[ 8], 0x455a14ed, 20)
+		MD5_STEP(MD5_G, a, b, c, d, x[13], 0xa9e3e905,  5)
+		MD5_STEP(MD5_G, d, a, b, c, x[ 2], 0xfcefa3f8,  9)
+		MD5_STEP(MD5_G, c, d, a, b, x[ 7], 0x676f02d9, 14)
+		MD5_STEP(MD5_G, b, c, d, a, x[12], 0x8d2a4c8a, 20)
+
+		MD5_STEP(MD5_H, a, b, c, d, x[ 5], 0xfffa3942,  4)
+		MD5_STEP(MD5_H, d, a, b, c, x[ 8], 0x8771f681, 11)
+		MD5_STEP(MD5_H, c, d, a, b, x[11], 0x6d9d6122, 16)
+		MD5_STEP(MD5_H, b, c, d, a, x[14], 0xfde5380c, 23)
+		MD5_STEP(MD5_H, a, b, c, d, x[ 1], 0xa4beea44,  4)
+		MD5_STEP(MD5_H, d, a, b, c, x[ 4], 0x4bdecfa9, 11)
+		MD5_STEP(MD5_H, c, d, a, b, x[ 7], 0xf6bb4b60, 16)
+		MD5_STEP(MD5_H, b, c, d, a, x[10], 0xbebfbc70, 23)
+		MD5_STEP(MD5_H, a, b, c, d, x[13], 0x289b7ec6,  4)
+		MD5_STEP(MD5_H, d, a, b, c, x[ 0], 0xeaa127fa, 11)
+		MD5_STEP(MD5_H, c, d, a, b, x[ 3], 0xd4ef3085, 16)
+		MD5_STEP(MD5_H, b, c, d, a, x[ 6], 0x04881d05, 23)
+		MD5_STEP(MD5_H, a, b, c, d, x[ 9], 0xd9d4d039,  4)
+		MD5_STEP(MD5_H, d, a, b, c, x[12], 0xe6db99e5, 11)
+		MD5_STEP(MD5_H, c, d, a, b, x[15], 0x1fa27cf8, 16)
+		MD5_STEP(MD5_H, b, c, d, a, x[ 2], 0xc4ac5665, 23)
+
+		MD5_STEP(MD5_I, a, b, c, d, x[ 0], 0xf4292244,  6)
+		MD5_STEP(MD5_I, d, a, b, c, x[ 7], 0x432aff97, 10)
+		MD5_STEP(MD5_I, c, d, a, b, x[14], 0xab9423a7, 15)
+		MD5_STEP(MD5_I, b, c, d, a, x[ 5], 0xfc93a039, 21)
+		MD5_STEP(MD5_I, a, b, c, d, x[12], 0x655b59c3,  6)
+		MD5_STEP(MD5_I, d, a, b, c, x[ 3], 0x8f0ccc92, 10)
+		MD5_STEP(MD5_I, c, d, a, b, x[10], 0xffeff47d, 15)
+		MD5_STEP(MD5_I, b, c, d, a, x[ 1], 0x85845dd1, 21)
+		MD5_STEP(MD5_I, a, b, c, d, x[ 8], 0x6fa87e4f,  6)
+		MD5_STEP(MD5_I, d, a, b, c, x[15], 0xfe2ce6e0, 10)
+		MD5_STEP(MD5_I, c, d, a, b, x[ 6], 0xa3014314, 15)
+		MD5_STEP(MD5_I, b, c, d, a, x[13], 0x4e0811a1, 21)
+		MD5_STEP(MD5_I, a, b, c, d, x[ 4], 0xf7537e82,  6)
+		MD5_STEP(MD5_I, d, a, b, c, x[11], 0xbd3af235, 10)
+		MD5_STEP(MD5_I, c, d, a, b, x[ 2], 0x2ad7d2bb, 15)
+		MD5_STEP(MD5_I, b, c, d, a, x[ 9], 0xeb86d391, 21)
+
+		a += aa;
+		b += bb;
+		c += cc;
+		d += dd;
+	}
+
+	m_state[0] = a;
+	m_state[1] = b;
+	m_state[2] = c;
+	m_state[3] = d;
+}
@@ -16,10 +16,27 @@
  * License along with this library; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
-#include <map>
-#include <set>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+
+#include <errno.h>
+
+#include <iostream>
+#include <algorithm>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <chrono>
 
 #include <boost/scoped_ptr.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/format.hpp>
 #include <boost/algorithm/string.hpp>
@@ -30,6 +47,13 @@
 #include <vpk/file.h>
 #include <vpk/package.h>
 #include <vpk/file_format_error.h>
+#include <vpk/io_error.h>
+#include <vpk/buffer_reader.h>
+#include <vpk/mapped_file.h>
+#include <vpk/ring.h>
+#include <vpk/crc32.h>
+#include <vpk/dir_cache.h>
+#include <vpk/spsc_queue.h>
 #include <vpk/file_data_handler_factory.h>
 #include <vpk/checking_data_handler_factory.h>
 
@@ -37,11 +61,55 @@ namespace fs   = boost::filesystem;
 namespace algo = boost::algorithm;
 
 void Vpk::Package::read(const fs::path &path) {
-	FileIO io(path, "rb");
-	read(path, io);
+	// the index references preload data of the current mapping
+	m_index.clear();
+	try {
+		m_mapping.open(path);
+	}
+	catch (const IOError&) {
+		// not mappable (e.g. a pipe), fall back to reading it as a stream
+		FileIO io(path, "rb");
+		read(path, io);
+		return;
+	}
+
+	init(path);
+	BufferReader reader(m_mapping.data(), m_mapping.size());
+
+	struct stat st;
+	if (m_cacheDir.empty() || ::stat(path.string().c_str(), &st) != 0) {
+		parse(reader, m_lazy);
+	}
+	else {
+		CacheKey key;
+		key.size      = st.st_size;
+		key.mtime     = st.st_mtim.tv_sec;
+		key.mtimeNsec = st.st_mtim.tv_nsec;
+
+		if (!readCache(key)) {
+			// only a complete index can be cached
+			parse(reader, false);
+			writeCache(key);
+		}
+		else {
+			parseFooter(reader);
+		}
+	}
+
+	// from now on only preload data is read, in no particular order
+	m_mapping.advise(MADV_NORMAL);
+	buildTree();
 }
 
 void Vpk::Package::read(const fs::path &path, FileIO &io) {
+	m_index.clear();
+	m_mapping.close();
+	init(path);
+	parse(io, m_lazy);
+	buildTree();
+}
+
+void Vpk::Package::init(const fs::path &path) {
 	fs::path abspath = fs::system_complete(path);
 	m_dirfile = abspath.filename().string();
 		
@@ -51,24 +119,32 @@ void Vpk::Package::read(const fs::path &path, FileIO &io) {
 		if (archiveerror(exc, abspath.string())) {
 			throw exc;
 		}
-		setName(m_dirfile);
+		m_name = m_dirfile;
 	}
 	else {
-		setName(m_dirfile.substr(0, m_dirfile.size()-8));
+		m_name = m_dirfile.substr(0, m_dirfile.size()-8);
 	}
+	setName(m_name.c_str());
 	m_srcdir = abspath.parent_path().string();
-	
-	read(io);
 }
 
-void Vpk::Package::read(FileIO &io) {
+// Reader is either FileIO or BufferReader. The latter walks the index
+// straight from a memory mapping of the directory file. A first pass
+// only records where the file records of each directory are.
+template<typename Reader>
+void Vpk::Package::parse(Reader &io, bool lazy) {
 	size_t headerSize = 0;
 	unsigned int indexSize = 0;
 
-	m_version      = 0;
-	m_dataOffset   = 0;
-	m_footerOffset = 0;
-	m_footerSize   = 0;
+	unsigned int dataSize = 0;
+
+	m_version        = 0;
+	m_dataOffset     = 0;
+	m_footerOffset   = 0;
+	m_footerSize     = 0;
+	m_archiveMd5Size = 0;
+	m_otherMd5Size   = 0;
+	m_signatureSize  = 0;
 
 	if (io.readLU32() != 0x55AA1234) {
 		io.seek(-4, FileIO::CUR);
@@ -78,10 +154,10 @@ void Vpk::Package::read(FileIO &io) {
 		indexSize = io.readLU32();
 
 		if (m_version == 2) {
-			m_footerOffset = io.readLU32();
-			io.readLU32(); // UNKNOWN
-			m_footerSize = io.readLU32();
-			io.readLU32(); // UNKNOWN
+			dataSize         = io.readLU32();
+			m_archiveMd5Size = io.readLU32();
+			m_otherMd5Size   = io.readLU32();
+			m_signatureSize  = io.readLU32();
 		}
 		else if (m_version != 1) {
 			throw FileFormatError((boost::format("unsupported VPK version: %u")
@@ -89,10 +165,16 @@ void Vpk::Package::read(FileIO &io) {
 		}
 
 		headerSize   = io.tell();
-		m_dataOffset = indexSize + headerSize; // + footerSize?
+		m_dataOffset = indexSize + headerSize;
+
+		// the footer follows the data stored in the directory file
+		if (m_version == 2) {
+			m_footerOffset = m_dataOffset + dataSize;
+			m_footerSize   = m_archiveMd5Size + m_otherMd5Size + m_signatureSize;
+		}
 	}
 
-	std::vector<File*> dirfiles;
+	m_index.clear();
 
 	// types
 	for (;;) {
@@ -106,7 +188,7 @@ void Vpk::Package::read(FileIO &io) {
 			io.readAsciiZ(path);
 			if (path.empty()) break;
 
-			mkpath(path).read(io, path, type, dirfiles);
+			m_index.defer(io, m_index.mkdir(path), type);
 		}
 	}
 
@@ -117,159 +199,469 @@ void Vpk::Package::read(FileIO &io) {
 		Exception exc(
 			(boost::format("missmatch between header index size (%u) and real index size (%u)")
 			% indexSize % (io.tell() - headerSize)).str());
-		if (archiveerror(exc, (fs::path(m_srcdir) / (name() + "_dir.vpk")).string())) {
+		if (archiveerror(exc, (fs::path(m_srcdir) / (m_name + "_dir.vpk")).string())) {
 			throw exc;
 		}
 	}
 
-	for (std::vector<File*>::iterator i = dirfiles.begin(); i != dirfiles.end(); ++ i) {
-		(*i)->offset += m_dataOffset;
+	m_index.relocate(m_dataOffset);
+
+	// the records of a mapped index are only decoded now, in parallel
+	if (!lazy) {
+		m_index.loadAll(m_threads);
 	}
+
+	parseFooter(io);
 }
 
-Vpk::Dir &Vpk::Package::mkpath(const char *path) {
-	if (!*path) {
-		throw Exception("empty path");
+static const size_t   CHUNK_HASH_SIZE = 12 + Vpk::Md5::DIGEST_SIZE;
+static const uint32_t HEADER_SIZE_V2  = 28;
+
+// Only the checksums are read, the signature section is ignored.
+template<typename Reader>
+void Vpk::Package::parseFooter(Reader &io) {
+	m_chunkHashes.clear();
+	m_hasMd5 = false;
+	if (m_version != 2 || m_footerSize == 0) return;
+
+	try {
+		if (m_archiveMd5Size % CHUNK_HASH_SIZE != 0) {
+			throw FileFormatError((boost::format("invalid archive MD5 section size: %u")
+				% m_archiveMd5Size).str());
+		}
+
+		io.seek(m_footerOffset, FileIO::SET);
+		m_chunkHashes.resize(m_archiveMd5Size / CHUNK_HASH_SIZE);
+		for (std::vector<ChunkHash>::iterator i = m_chunkHashes.begin(); i != m_chunkHashes.end(); ++ i) {
+			uint32_t archive = io.readLU32();
+			if (archive > 0xFFFF) {
+				throw FileFormatError((boost::format("invalid archive index in archive MD5 section: %u")
+					% archive).str());
+			}
+			i->archive = archive;
+			i->offset  = io.readLU32();
+			i->size    = io.readLU32();
+			io.read((char*) i->md5.bytes, Md5::DIGEST_SIZE);
+		}
+
+		if (m_otherMd5Size >= 3 * Md5::DIGEST_SIZE) {
+			io.read((char*) m_treeMd5.bytes,        Md5::DIGEST_SIZE);
+			io.read((char*) m_chunkHashesMd5.bytes, Md5::DIGEST_SIZE);
+			io.read((char*) m_fileMd5.bytes,        Md5::DIGEST_SIZE);
+			m_hasMd5 = true;
+		}
+	}
+	catch (const std::exception &exc) {
+		m_chunkHashes.clear();
+		m_hasMd5 = false;
+		if (archiveerror(exc, (fs::path(m_srcdir) / m_dirfile).string())) {
+			throw;
+		}
+	}
+}
+
+// The cache file is a dump of the index arrays in host byte order. It
+// is keyed by the absolute path, size and mtime of the directory file.
+struct CacheHeader {
+	char     magic[8];
+	uint32_t format;
+	uint32_t byteOrder;
+	uint64_t size;
+	int64_t  mtime;
+	uint32_t mtimeNsec;
+	uint32_t pathSize;
+	uint32_t version;
+	uint32_t dataOffset;
+	uint32_t footerOffset;
+	uint32_t footerSize;
+	uint32_t archiveMd5Size;
+	uint32_t otherMd5Size;
+	uint32_t signatureSize;
+	uint32_t padding;
+};
+
+static const char     CACHE_MAGIC[8]   = {'V', 'P', 'K', 'I', 'N', 'D', 'E', 'X'};
+static const uint32_t CACHE_FORMAT     = 5;
+static const uint32_t CACHE_BYTE_ORDER = 0x01020304;
+
+fs::path Vpk::Package::cachePath() const {
+	std::string path = (fs::path(m_srcdir) / m_dirfile).string();
+
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (std::string::const_iterator i = path.begin(); i != path.end(); ++ i) {
+		hash ^= (unsigned char) *i;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return fs::path(m_cacheDir) / (boost::format("%016x.vpkindex") % hash).str();
+}
+
+bool Vpk::Package::readCache(const CacheKey &key) {
+	std::string path = (fs::path(m_srcdir) / m_dirfile).string();
+	try {
+		MappedFile cache(cachePath());
+		BufferReader reader(cache.data(), cache.size());
+
+		CacheHeader header;
+		reader.read((char*) &header, sizeof(header));
+		if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+			header.format    != CACHE_FORMAT ||
+			header.byteOrder != CACHE_BYTE_ORDER ||
+			header.size      != key.size ||
+			header.mtime     != key.mtime ||
+			header.mtimeNsec != key.mtimeNsec ||
+			header.pathSize  != path.size() ||
+			path.compare(0, path.size(), reader.skip(path.size()), path.size()) != 0) {
+			return false;
+		}
+		reader.skip((8 - path.size() % 8) % 8);
+
+		m_index.restore(reader, m_mapping.data(), m_mapping.size());
+		m_version        = header.version;
+		m_dataOffset     = header.dataOffset;
+		m_footerOffset   = header.footerOffset;
+		m_footerSize     = header.footerSize;
+		m_archiveMd5Size = header.archiveMd5Size;
+		m_otherMd5Size   = header.otherMd5Size;
+		m_signatureSize  = header.signatureSize;
+	}
+	catch (const Exception&) {
+		// missing or broken, just parse again
+		m_index.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void Vpk::Package::writeCache(const CacheKey &key) {
+	std::string path = (fs::path(m_srcdir) / m_dirfile).string();
+	fs::path cachefile = cachePath();
+	fs::path tmpfile   = cachefile.string() + (boost::format(".%d.tmp") % getpid()).str();
+
+	CacheHeader header;
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.format         = CACHE_FORMAT;
+	header.byteOrder      = CACHE_BYTE_ORDER;
+	header.size           = key.size;
+	header.mtime          = key.mtime;
+	header.mtimeNsec      = key.mtimeNsec;
+	header.pathSize       = path.size();
+	header.version        = m_version;
+	header.dataOffset     = m_dataOffset;
+	header.footerOffset   = m_footerOffset;
+	header.footerSize     = m_footerSize;
+	header.archiveMd5Size = m_archiveMd5Size;
+	header.otherMd5Size   = m_otherMd5Size;
+	header.signatureSize  = m_signatureSize;
+	header.padding        = 0;
+
+	// written to a temporary file first so concurrent readers never see
+	// a partial cache
+	try {
+		fs::create_directories(m_cacheDir);
+
+		FileIO io(tmpfile, "wb");
+		io.write((const char*) &header, sizeof(header));
+		io.write(path.c_str(), path.size());
+		size_t pad = (8 - path.size() % 8) % 8;
+		if (pad > 0) {
+			io.write(std::string(pad, '\0').c_str(), pad);
+		}
+		m_index.save(io);
+		io.close();
+
+		fs::rename(tmpfile, cachefile);
+	}
+	catch (const std::exception &exc) {
+		boost::system::error_code error;
+		fs::remove(tmpfile, error);
+		std::cerr
+			<< "*** warning: cannot write index cache \""
+			<< cachefile.string() << "\": " << exc.what() << "\n";
+	}
+}
+
+// The node tree is only a view of the index for path based access.
+// Nodes and their names are allocated from the arena of the package.
+void Vpk::Package::buildTree() {
+	clearTree();
+
+	// duplicates in a complete index are dropped before there are any
+	// nodes, those of deferred directories are found when loading them
+	if (!m_index.pending()) {
+		dropShadowed();
+	}
+
+	// nodes point into the index, which must not move when the
+	// deferred records are loaded
+	m_index.reserve();
+	m_unloaded = 0;
+
+	m_dirById.assign(m_index.dirs(), 0);
+	m_dirById[Index::ROOT] = this;
+	for (Index::Id id = Index::ROOT + 1, n = m_index.dirs(); id < n; ++ id) {
+		Dir *dir = newDir(m_index.dirName(id), id);
+		m_dirById[m_index.dirParent(id)]->add(dir);
+		m_dirById[id] = dir;
 	}
 
-	Dir *dir = this;
-	const char *ptr = path;
-	while (*ptr == '/') ++ ptr;
-	while (*ptr) {
-		const char *slash = strchr(ptr, '/');
-		if (!slash) {
-			Node *node = dir->node(ptr);
-			if (!node) {
-				Dir *newdir = new Dir(ptr);
-				dir->add(newdir);
-				dir = newdir;
+	m_shadowed.clear();
+	m_shadowedFiles = 0;
+	m_fileById.assign(m_index.files(), 0);
+	if (m_index.grouped()) {
+		// the files of each directory are already known (e.g. restored
+		// from the cache), only their nodes are created lazily
+		for (Index::Id id = Index::ROOT, n = m_index.dirs(); id < n; ++ id) {
+			if (m_index.firstFile(id) < m_index.lastFile(id)) {
+				m_dirById[id]->setLoader(this);
+				++ m_unloaded;
 			}
-			else if (node->type() != Node::DIR) {
-				throw Exception((boost::format("path is not a directory: \"%s\"")
-					% path).str());
+		}
+		return;
+	}
+	addFiles(0, m_index.files());
+
+	if (m_index.pending()) {
+		for (Index::Id id = Index::ROOT, n = m_index.dirs(); id < n; ++ id) {
+			if (m_index.pending(id)) {
+				m_dirById[id]->setLoader(this);
+				++ m_unloaded;
 			}
-			else {
-				dir = (Dir*) node;
+		}
+	}
+}
+
+// Threads that access the directory meanwhile wait for the lock and
+// then find it loaded.
+void Vpk::Package::load(Dir &dir) {
+	std::lock_guard<std::recursive_mutex> lock(m_loadMutex);
+	if (dir.loaded()) return;
+
+	Index::Id id = dir.id();
+	if (m_index.pending(id)) {
+		Index::Id first = m_index.files();
+		m_index.load(id);
+		m_fileById.resize(m_index.files(), 0);
+		addFiles(first, m_index.files());
+	}
+	else {
+		addFiles(m_index.firstFile(id), m_index.lastFile(id));
+	}
+	dir.setLoader(0);
+	-- m_unloaded;
+}
+
+void Vpk::Package::addFiles(Index::Id first, Index::Id last) {
+	m_shadowed.resize(m_index.files(), false);
+	for (Index::Id id = first; id < last; ++ id) {
+		// the directory is still being loaded, so it is not looked up
+		Dir *dir = m_dirById[m_index.parent(id)];
+		const char *name = m_index.name(id);
+		File *file = new (m_arena.allocate<File>()) File(name, m_index, id);
+		Node *node = dir->add(file);
+		if (node) {
+			std::cerr
+				<< "*** warning: file occured more than once: \""
+				<< m_index.dirPath(dir->id()) << "/" << name << "\"\n";
+			if (node->type() == Node::FILE) {
+				m_shadowed[((File*) node)->id()] = true;
+				++ m_shadowedFiles;
 			}
-			break;
 		}
-		else {
-			std::string name(ptr, slash - ptr);
-			Node *node = dir->node(name);
-			if (!node) {
-				Dir *newdir = new Dir(name);
-				dir->add(newdir);
-				dir = newdir;
+		m_fileById[id] = file;
+	}
+}
+
+// like before only the last occurence of a file is used
+void Vpk::Package::dropShadowed() {
+	std::vector<bool> files;
+	if (m_index.shadowed(files)) {
+		for (Index::Id id = 0, n = m_index.files(); id < n; ++ id) {
+			if (files[id]) {
+				std::cerr
+					<< "*** warning: file occured more than once: \""
+					<< m_index.dirPath(m_index.parent(id)) << "/" << m_index.name(id) << "\"\n";
 			}
-			else if (node->type() != Node::DIR) {
+		}
+		files.flip();
+		m_index.retain(files, std::vector<bool>(m_index.dirs(), false));
+	}
+}
+
+// Loading only materializes what is already there, so it does not
+// change the package as seen from the outside. Nodes stay valid,
+// files shadowed by a later duplicate are only skipped by the walks.
+void Vpk::Package::loadAll() const {
+	for (std::vector<Dir*>::const_iterator i = m_dirById.begin(); i != m_dirById.end(); ++ i) {
+		(*i)->load();
+	}
+}
+
+// Only directories need their destructor to be run, files are just
+// released together with the arena.
+void Vpk::Package::clearTree() {
+	for (std::vector<Dir*>::iterator i = m_dirs.begin(); i != m_dirs.end(); ++ i) {
+		(*i)->~Dir();
+	}
+	m_dirs.clear();
+	m_dirById.clear();
+	m_fileById.clear();
+	clear();
+	m_arena.clear();
+}
+
+Vpk::Dir *Vpk::Package::newDir(const char *name, Index::Id id) {
+	Dir *dir = new (m_arena.allocate<Dir>()) Dir(name, id);
+	m_dirs.push_back(dir);
+	return dir;
+}
+
+Vpk::Dir &Vpk::Package::mkpath(const char *path) {
+	if (!*path) {
+		throw Exception("empty path");
+	}
+
+	// no prefix of path may be a file
+	for (const char *ptr = path; *ptr; ++ ptr) {
+		if (ptr[1] == '/' || ptr[1] == '\0') {
+			Node *node = get(std::string(path, ptr + 1).c_str());
+			if (!node) break;
+			if (node->type() != Node::DIR) {
 				throw Exception((boost::format("path is not a directory: \"%s\"")
-					% std::string(path, slash - path)).str());
-			}
-			else {
-				dir = (Dir*) node;
+					% std::string(path, ptr + 1)).str());
 			}
-			ptr = slash + 1;
-			while (*ptr == '/') ++ ptr;
 		}
 	}
 
-	return *dir;
+	if (m_dirById.empty()) {
+		m_dirById.push_back(this);
+	}
+
+	Index::Id id = m_index.mkdir(path);
+	for (Index::Id dir = m_dirById.size(), n = m_index.dirs(); dir < n; ++ dir) {
+		Dir *node = newDir(m_index.dirName(dir), dir);
+		m_dirById[m_index.dirParent(dir)]->add(node);
+		m_dirById.push_back(node);
+	}
+	return *m_dirById[id];
 }
 
 Vpk::Node *Vpk::Package::get(const char *path) {
 	if (!*path) return 0;
-	
-	Node *node = this;
-	Dir  *dir  = this;
-	const char *ptr = path;
-	while (*ptr == '/') ++ ptr;
-	while (*ptr) {
-		const char *slash = strchr(ptr, '/');
-		if (!slash) {
-			return dir->node(ptr);
-		}
-		else {
-			node = dir->node(std::string(ptr, slash - ptr));
-			if (!node) {
-				return 0;
-			}
-			ptr = slash + 1;
-			while (*ptr == '/') ++ ptr;
+	while (*path == '/') ++ path;
 
-			if (*ptr) {
-				if (node->type() != Node::DIR) {
-					return 0;
-				}
-				dir = (Dir*) node;
+	size_t length = strlen(path);
+	if (length > 0 && (path[length - 1] == '/' || memmem(path, length, "//", 2))) {
+		std::string normalized;
+		for (const char *ptr = path; *ptr; ++ ptr) {
+			if (*ptr != '/' || (ptr[1] && ptr[1] != '/')) {
+				normalized += *ptr;
 			}
 		}
+		return get(normalized.c_str(), normalized.size());
 	}
 
-	return node;
+	return get(path, length);
 }
 
-static size_t filecount(const Vpk::Nodes &nodes) {
-	size_t n = 0;
-	for (Vpk::Nodes::const_iterator it = nodes.begin(); it != nodes.end(); ++ it) {
-		Vpk::Node *node = it->second.get();
-		if (node->type() == Vpk::Node::DIR) {
-			n += filecount(((const Vpk::Dir*) node)->nodes());
-		}
-		else {
-			++ n;
-		}
+Vpk::Node *Vpk::Package::get(const char *path, size_t length) {
+	// the tree only changes while directories are left to load
+	if (m_unloaded.load(std::memory_order_acquire) > 0) {
+		std::lock_guard<std::recursive_mutex> lock(m_loadMutex);
+		return lookup(path, length);
 	}
-
-	return n;
+	return lookup(path, length);
 }
 
-size_t Vpk::Package::filecount() const {
-	return ::filecount(nodes());
-}
-
-void Vpk::Package::filter(Dir &dir, const std::set<Node*> &keep) {
-	std::vector<std::string> erase;
-	for (Nodes::iterator it = dir.begin(); it != dir.end(); ++ it) {
-		Node *node = it->second.get();
-		bool kept = keep.find(node) != keep.end();
-		if (node->type() == Node::DIR) {
-			if (!kept) {
-				Dir *subdir = (Dir*) node;
-				filter(*subdir, keep);
-				if (subdir->empty()) {
-					erase.push_back(subdir->name());
-				}
-			}
+Vpk::Node *Vpk::Package::lookup(const char *path, size_t length) {
+	Index::Entry entry = m_index.find(path, length);
+
+	// files of deferred directories are only in the index once their
+	// directory is loaded
+	if (entry == Index::NOT_FOUND && m_index.pending()) {
+		const char *slash = (const char*) memrchr(path, '/', length);
+		size_t dirlength = slash ? slash - path : 0;
+		bool loaded = false;
+		for (Index::Id dir; (dir = m_index.findPending(path, dirlength)) != Index::NOT_FOUND;) {
+			m_dirById[dir]->load();
+			loaded = true;
 		}
-		else if (!kept) {
-			erase.push_back(node->name());
+		if (loaded) {
+			entry = m_index.find(path, length);
 		}
 	}
 
-	for (std::vector<std::string>::const_iterator it = erase.begin(); it != erase.end(); ++ it) {
-		dir.remove(*it);
+	if (entry == Index::NOT_FOUND) {
+		return 0;
 	}
+	else if (Index::isDir(entry)) {
+		return m_dirById[Index::entryId(entry)];
+	}
+
+	// and file nodes only exist once their directory is loaded
+	Index::Id file = Index::entryId(entry);
+	if (!m_fileById[file]) {
+		m_dirById[m_index.parent(file)]->load();
+	}
+	return m_fileById[file];
+}
+
+size_t Vpk::Package::filecount() const {
+	if (m_unloaded.load(std::memory_order_acquire) > 0) {
+		std::lock_guard<std::recursive_mutex> lock(m_loadMutex);
+		return m_index.records() - m_shadowedFiles;
+	}
+	return m_index.records() - m_shadowedFiles;
 }
 
 void Vpk::Package::filter(const std::vector<std::string> &paths) {
-	std::set<Node*> keep;
+	std::vector<bool> keepDirs(m_index.dirs(), false);
+	std::vector<Index::Id> files;
 	for (std::vector<std::string>::const_iterator i = paths.begin(); i != paths.end(); ++ i) {
 		Node *node = get(*i);
 		if (node == this) {
 			return;
 		}
-		else if (node) {
-			keep.insert(node);
-		}
-		else {
+		else if (!node) {
 			Exception exc("no such file or directory");
 			if (filtererror(exc, *i)) {
 				throw exc;
 			}
 		}
+		else if (node->type() == Node::DIR) {
+			keepDirs[((Dir*) node)->id()] = true;
+		}
+		else {
+			files.push_back(((File*) node)->id());
+		}
+	}
+
+	// kept directories keep all files inside of them, so only those
+	// need to be loaded
+	std::vector<bool> subtree(keepDirs);
+	for (Index::Id id = Index::ROOT + 1, n = m_index.dirs(); id < n; ++ id) {
+		if (subtree[m_index.dirParent(id)]) {
+			subtree[id] = true;
+		}
+		if (subtree[id]) {
+			m_dirById[id]->load();
+		}
 	}
 
-	filter(*this, keep);
+	std::vector<bool> keepFiles(m_index.files(), false);
+	for (std::vector<Index::Id>::const_iterator i = files.begin(); i != files.end(); ++ i) {
+		keepFiles[*i] = true;
+	}
+	for (Index::Id id = 0, n = m_index.files(); id < n; ++ id) {
+		if (subtree[m_index.parent(id)] && !shadowed(id)) {
+			keepFiles[id] = true;
+		}
+	}
+
+	m_index.retain(keepFiles, keepDirs);
+	buildTree();
 }
 
 bool Vpk::Package::error(const std::string &msg, const std::string &path, ErrorMethod handler) const {
@@ -298,129 +690,1598 @@ boost::filesystem::path Vpk::Package::archivePath(uint16_t index) const {
 	return fs::path(m_srcdir) / archiveName(index);
 }
 
-void Vpk::Package::extract(const std::string &destdir, bool check) const {
-	FileDataHandlerFactory factory(destdir, check);
-	process(factory);
+// Hands out work items that each read from one archive, grouped by the
+// device the archive is on (see Package::setDevice()). Every device is a
+// stream of its items in order, worked on by at most limit() workers at
+// a time. Workers take the next item of the least busy device.
+class DeviceQueue {
+public:
+	DeviceQueue(const Vpk::Package &package, const std::vector<uint16_t> &archives,
+	            unsigned int threads, unsigned int deviceThreads);
+
+	// the number of workers to start
+	size_t workers() const { return m_workers; }
+	unsigned int limit() const { return m_limit; }
+	size_t devices() const { return m_streams.size(); }
+
+	bool next(size_t &item);
+	void done(size_t item);
+
+private:
+	struct Stream {
+		std::vector<size_t> items;
+		size_t              next;
+		unsigned int        active;
+	};
+
+	std::mutex          m_mutex;
+	std::vector<Stream> m_streams;
+	std::vector<size_t> m_device; // of every item
+	size_t              m_workers;
+	unsigned int        m_limit;
+};
+
+// Archives that can't be stat()ed form a device of their own, opening
+// them fails anyway.
+static std::string deviceOf(const Vpk::Package &package, uint16_t archive) {
+	Vpk::Package::Devices::const_iterator assigned = package.devices().find(archive);
+	if (assigned != package.devices().end()) {
+		return assigned->second;
+	}
+
+	struct stat st;
+	if (stat(package.archivePath(archive).c_str(), &st) != 0) {
+		return std::string();
+	}
+	return (boost::format("st_dev %lu") % (unsigned long) st.st_dev).str();
 }
 
-void Vpk::Package::check() const {
-	CheckingDataHandlerFactory factory;
-	process(factory);
+DeviceQueue::DeviceQueue(const Vpk::Package &package, const std::vector<uint16_t> &archives,
+                         unsigned int threads, unsigned int deviceThreads) : m_device(archives.size()) {
+	boost::unordered_map<uint16_t, size_t>    byArchive;
+	boost::unordered_map<std::string, size_t> byName;
+	for (size_t i = 0, n = archives.size(); i < n; ++ i) {
+		boost::unordered_map<uint16_t, size_t>::iterator known = byArchive.find(archives[i]);
+		if (known == byArchive.end()) {
+			std::string name = deviceOf(package, archives[i]);
+			boost::unordered_map<std::string, size_t>::iterator device = byName.find(name);
+			if (device == byName.end()) {
+				device = byName.insert(std::make_pair(name, m_streams.size())).first;
+				Stream stream = { std::vector<size_t>(), 0, 0 };
+				m_streams.push_back(stream);
+			}
+			known = byArchive.insert(std::make_pair(archives[i], device->second)).first;
+		}
+		m_device[i] = known->second;
+		m_streams[known->second].items.push_back(i);
+	}
+
+	// by default the threads are split among the devices, but every
+	// device gets at least one
+	size_t devices = std::max(m_streams.size(), (size_t) 1);
+	if (deviceThreads > 0) {
+		m_limit   = deviceThreads;
+		m_workers = devices * deviceThreads;
+	}
+	else {
+		m_workers = std::max((size_t) threads, devices);
+		m_limit   = (m_workers + devices - 1) / devices;
+	}
 }
 
-void Vpk::Package::process(const Nodes &nodes,
-                           const std::vector<std::string> &prefix,
-                           Archives &archives,
-                           DataHandlerFactory &factory) const {
-	for (Nodes::const_iterator it = nodes.begin(); it != nodes.end(); ++ it) {
-		const Node *node = it->second.get();
-		std::vector<std::string> pathvec(prefix);
-		pathvec.push_back(node->name());
-		if (node->type() == Node::DIR) {
-			process(((const Dir*) node)->nodes(), pathvec, archives, factory);
+bool DeviceQueue::next(size_t &item) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Stream *best = 0;
+	for (std::vector<Stream>::iterator stream = m_streams.begin(); stream != m_streams.end(); ++ stream) {
+		if (stream->next < stream->items.size() && stream->active < m_limit &&
+			(!best || stream->active < best->active ||
+			 (stream->active == best->active && stream->items[stream->next] < best->items[best->next]))) {
+			best = &*stream;
 		}
-		else {
-			const File *file = (const File*) node;
-			std::string path = algo::join(pathvec, "/");
+	}
+	if (!best) return false;
 
-			if (m_handler) m_handler->extract(path);
-			boost::scoped_ptr<DataHandler> dataHandler;
-				
-			try {
-				dataHandler.reset(factory.create(path, file->crc32));
-			}
-			catch (const std::exception &exc) {
-				if (fileerror(exc, path)) throw;
-				continue;
-			}
-	
-			size_t preloadSize = file->preload.size();
-			if (preloadSize > 0) {
+	item = best->items[best->next ++];
+	++ best->active;
+	return true;
+}
+
+void DeviceQueue::done(size_t item) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	-- m_streams[m_device[item]].active;
+}
+
+// Runs work(worker, i) for every i < count handed out by queue on
+// queue.workers() workers and report(i) on the calling thread in order
+// of i as soon as work(i) is done, so the handler is only ever called
+// from this thread. Exceptions thrown by work(i) are rethrown in place
+// of report(i). Once anything throws the remaining work is skipped.
+template<typename Work, typename Report>
+static void ordered(size_t count, DeviceQueue &queue, Work work, Report report) {
+	std::mutex mutex;
+	std::condition_variable done;
+	std::vector<bool> finished(count, false);
+	std::vector<std::exception_ptr> errors(count);
+	std::atomic<bool> stop(false);
+
+	std::vector<std::thread> workers;
+	for (size_t worker = 0, n = std::min(queue.workers(), count); worker < n; ++ worker) {
+		workers.push_back(std::thread([&, worker]() {
+			for (size_t i; !stop && queue.next(i);) {
+				std::exception_ptr error;
 				try {
-					dataHandler->process((char*) &file->preload[0], preloadSize);
+					work(worker, i);
 				}
-				catch (const std::exception &exc) {
-					if (fileerror(exc, path)) throw;
-					continue;
+				catch (...) {
+					error = std::current_exception();
 				}
-			}
+				queue.done(i);
 
-			boost::shared_ptr<FileIO> archive;
-			
-			Archives::iterator i = archives.find(file->index);
-			if (i != archives.end()) {
-				archive = i->second;
-				if (!archive) {
-					Exception exc("archive does not exist");
-					if (archiveerror(exc, this->archivePath(file->index).string())) {
-						throw exc;
-					}
-					continue;
-				}
+				std::lock_guard<std::mutex> lock(mutex);
+				errors[i]   = error;
+				finished[i] = true;
+				done.notify_all();
 			}
-			else {
-				fs::path archivePath(this->archivePath(file->index));
-				if (!fs::exists(archivePath)) {
-					Exception exc("archive does not exist");
-					if (archiveerror(exc, archivePath.string())) {
-						throw exc;
-					}
+		}));
+	}
 
-					archives[file->index] = boost::shared_ptr<FileIO>();
-					continue;
+	try {
+		for (size_t i = 0; i < count; ++ i) {
+			std::exception_ptr error;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (!finished[i]) {
+					done.wait(lock);
 				}
-				archive.reset(new FileIO(archivePath));
-				archives[file->index] = archive;
+				error = errors[i];
 			}
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			report(i);
+		}
+	}
+	catch (...) {
+		stop = true;
+		for (std::vector<std::thread>::iterator i = workers.begin(); i != workers.end(); ++ i) {
+			i->join();
+		}
+		throw;
+	}
 
-			archive->seek(file->offset, FileIO::SET);
-			char data[BUFSIZ];
-			size_t left = file->size;
-			bool fail = false;
-			while (left > 0) {
-				size_t count = std::min(left, (size_t)BUFSIZ);
-				try {
-					archive->read(data, count);
-				}
-				catch (const std::exception& exc) {
-					if (archiveerror(exc, archivePath(file->index).string())) throw;
-					fail = true;
-					break;
-				}
-
-				try {
-					dataHandler->process(data, count);
-				}
-				catch (const std::exception& exc) {
-					if (fileerror(exc, path)) throw;
-					fail = true;
-					break;
-				}
+	for (std::vector<std::thread>::iterator i = workers.begin(); i != workers.end(); ++ i) {
+		i->join();
+	}
+}
 
-				left -= count;
-			}
+// Reads size bytes at offset. Returns how many bytes were read, which is
+// less only if error was set.
+static size_t readAt(int fd, char *buffer, size_t size, uint64_t offset, std::string &error) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t count = pread(fd, buffer + done, size - done, offset + done);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			error = strerror(errno);
+			break;
+		}
+		else if (count == 0) {
+			error = "Unexpected end of file";
+			break;
+		}
+		done += count;
+	}
+	return done;
+}
 
-			if (fail) continue;
-				
+// Opens an archive the first time it is needed. Returns its file
+// descriptor or -1 if it could not be opened, the reason is in errors.
+static int openArchive(const Vpk::Package &package, uint16_t index,
+	Vpk::Package::Archives &archives, boost::unordered_map<uint16_t, std::string> &errors) {
+	Vpk::Package::Archives::iterator archive = archives.find(index);
+	if (archive == archives.end()) {
+		archive = archives.insert(std::make_pair(index, boost::shared_ptr<Vpk::FileIO>())).first;
+		fs::path path = package.archivePath(index);
+		if (!fs::exists(path)) {
+			errors[index] = "archive does not exist";
+		}
+		else {
 			try {
-				dataHandler->finish();
+				archive->second.reset(new Vpk::FileIO(path));
 			}
-			catch (const std::exception& exc) {
-				if (fileerror(exc, path)) throw;
-				continue;
+			catch (const std::exception &exc) {
+				errors[index] = exc.what();
 			}
-			
-			if (m_handler) m_handler->success(path);
 		}
 	}
+	return archive->second ? archive->second->fileno() : -1;
 }
 
-void Vpk::Package::process(DataHandlerFactory &factory) const {
+static const size_t READ_SIZE     = 256 * 1024;
+static const size_t MIN_COPY_SIZE = 256 * 1024;
+// files only checked are hashed in pieces of this size on any worker
+static const uint64_t CRC_PIECE_SIZE = 16 * 1024 * 1024;
+
+// a range of an archive and its expected MD5 sum
+struct Md5Job {
+	uint16_t         archive;
+	uint64_t         offset;
+	uint64_t         size;
+	Vpk::Md5::Digest md5;
+	std::string      name;
+};
+
+struct Md5Result {
+	Vpk::Md5::Digest md5;
+	std::string      error;
+};
+
+// Workers hash the ranges in any order, but the results are reported
+// to the handler in the order of the footer.
+void Vpk::Package::verifyMd5() const {
+	if (!m_hasMd5 && m_chunkHashes.empty()) {
+		throw Exception("package has no MD5 sums");
+	}
+
+	std::vector<Md5Job> jobs;
+	if (m_hasMd5) {
+		Md5Job tree = { Index::DIR_ARCHIVE, HEADER_SIZE_V2, m_dataOffset - HEADER_SIZE_V2,
+			m_treeMd5, m_dirfile + " (index)" };
+		Md5Job section = { Index::DIR_ARCHIVE, m_footerOffset, m_archiveMd5Size,
+			m_chunkHashesMd5, m_dirfile + " (archive MD5 section)" };
+		// everything up to the whole file MD5 itself
+		Md5Job file = { Index::DIR_ARCHIVE, 0, m_footerOffset + m_archiveMd5Size + 2 * Md5::DIGEST_SIZE,
+			m_fileMd5, m_dirfile };
+		jobs.push_back(tree);
+		jobs.push_back(section);
+		jobs.push_back(file);
+	}
+	for (std::vector<ChunkHash>::const_iterator i = m_chunkHashes.begin(); i != m_chunkHashes.end(); ++ i) {
+		uint64_t offset = i->archive == Index::DIR_ARCHIVE ? (uint64_t) i->offset + m_dataOffset : i->offset;
+		Md5Job job = { i->archive, offset, i->size, i->md5,
+			(boost::format("%s [%u, %u)") % archiveName(i->archive) % offset % (offset + i->size)).str() };
+		jobs.push_back(job);
+	}
+
+	// archives are opened up front, the workers only pread() from them
 	Archives archives;
+	boost::unordered_map<uint16_t, std::string> openErrors;
+	std::vector<int> fds(jobs.size(), -1);
+	std::vector<Md5Result> results(jobs.size());
+	for (size_t i = 0, n = jobs.size(); i < n; ++ i) {
+		uint16_t index = jobs[i].archive;
+		fds[i] = openArchive(*this, index, archives, openErrors);
+		if (fds[i] < 0) {
+			results[i].error = openErrors[index];
+		}
+	}
 
-	if (m_handler) m_handler->begin(*this);
+	std::vector<uint16_t> jobArchives(jobs.size());
+	for (size_t i = 0, n = jobs.size(); i < n; ++ i) {
+		jobArchives[i] = jobs[i].archive;
+	}
+	DeviceQueue queue(*this, jobArchives, m_threads, m_deviceThreads);
+	std::vector< std::vector<char> > buffers(queue.workers());
+
+	// an archive that can't be opened or read is reported once, its
+	// other ranges are skipped
+	std::vector<bool> failed(0x10000, false);
+
+	if (m_handler) m_handler->begin(*this, jobs.size());
+	ordered(jobs.size(), queue,
+		[&](size_t worker, size_t i) {
+			const Md5Job &job = jobs[i];
+			Md5Result &result = results[i];
+			std::vector<char> &buffer = buffers[worker];
+			buffer.resize(READ_SIZE);
 
-	process(nodes(), std::vector<std::string>(), archives, factory);
+			Md5 md5;
+			for (uint64_t offset = job.offset, end = job.offset + job.size; fds[i] >= 0 && offset < end;) {
+				size_t count = std::min(end - offset, (uint64_t) buffer.size());
+				if (readAt(fds[i], &buffer[0], count, offset, result.error) < count) break;
+				md5.process(&buffer[0], count);
+				offset += count;
+			}
+			result.md5 = md5.digest();
+		},
+		[&](size_t i) {
+			const Md5Job &job = jobs[i];
+			const Md5Result &result = results[i];
+			if (failed[job.archive]) return;
+			if (m_handler) m_handler->extract(job.name);
 
+			if (!result.error.empty()) {
+				failed[job.archive] = true;
+				Exception exc(result.error);
+				if (archiveerror(exc, archivePath(job.archive).string())) {
+					throw exc;
+				}
+			}
+			else if (result.md5 != job.md5) {
+				Exception exc((boost::format("MD5 missmatch, expected %s, got %s")
+					% job.md5.str() % result.md5.str()).str());
+				if (fileerror(exc, job.name)) {
+					throw exc;
+				}
+			}
+			else if (m_handler) {
+				m_handler->success(job.name);
+			}
+		});
 	if (m_handler) m_handler->end();
 }
+
+// outcome of handling one file, kept until it is reported
+struct Vpk::Package::ProcessResult {
+	enum Status {
+		OK,
+		FILE_ERROR,
+		ARCHIVE_ERROR
+	};
+
+	std::string path;
+	Status      status;
+	std::string error;
+};
+
+// Tells the handler about the outcome of a file. The strings of the
+// result are not needed anymore afterwards and are released.
+void Vpk::Package::report(ProcessResult &result, uint16_t archive) const {
+	if (m_handler) m_handler->extract(result.path);
+
+	if (result.status == ProcessResult::FILE_ERROR) {
+		Exception exc(result.error);
+		if (fileerror(exc, result.path)) {
+			throw exc;
+		}
+	}
+	else if (result.status == ProcessResult::ARCHIVE_ERROR) {
+		Exception exc(result.error);
+		if (archiveerror(exc, archivePath(archive).string())) {
+			throw exc;
+		}
+	}
+	else if (m_handler) {
+		m_handler->success(result.path);
+	}
+
+	std::string().swap(result.path);
+	std::string().swap(result.error);
+}
+
+// every worker opens the archives it reads from on its own
+struct ProcessWorker {
+	Vpk::Package::Archives                      archives;
+	boost::unordered_map<uint16_t, std::string> openErrors;
+	std::vector<char>                           buffer;
+	std::vector<Vpk::DataEntry>                 batch;      // small files within buffer
+	std::vector<size_t>                         batchFiles; // and their places in the schedule
+};
+
+// Files [first, last) of the schedule, stored in one archive in
+// ascending order. Their data is within [begin, end). A piece is a
+// range of the data of a single big file.
+struct ReadRun {
+	size_t   first;
+	size_t   last;
+	uint64_t begin;
+	uint64_t end;
+	bool     piece;
+};
+
+// Greedily extends runs while the next file is in the same archive and
+// starts at most gap bytes after the end of the run, as long as the run
+// fits into one read of size bytes. Empty files join any run of their
+// archive. If pieceSize is given files bigger than that are split into
+// runs of their own of at most pieceSize bytes.
+static void planReads(const Vpk::Index &index, const std::vector<Vpk::Index::Id> &files,
+                      size_t size, size_t gap, std::vector<ReadRun> &runs, uint64_t pieceSize = 0) {
+	runs.clear();
+	for (size_t i = 0, n = files.size(); i < n; ++ i) {
+		Vpk::Index::Id file = files[i];
+		uint64_t begin = index.offset(file);
+		uint64_t end   = begin + index.size(file);
+
+		if (pieceSize > 0 && end - begin > pieceSize) {
+			for (; begin < end; begin += pieceSize) {
+				ReadRun piece = { i, i + 1, begin, std::min(end, begin + pieceSize), true };
+				runs.push_back(piece);
+			}
+			continue;
+		}
+
+		if (!runs.empty() && !runs.back().piece) {
+			ReadRun &run = runs.back();
+			Vpk::Index::Id last = files[run.last - 1];
+			if (index.archive(last) == index.archive(file)) {
+				if (begin == end) {
+					run.last = i + 1;
+					continue;
+				}
+				else if (run.begin == run.end) {
+					run.last  = i + 1;
+					run.begin = begin;
+					run.end   = end;
+					continue;
+				}
+				else if (begin >= run.end && begin - run.end <= gap && end - run.begin <= size) {
+					run.last = i + 1;
+					run.end  = end;
+					continue;
+				}
+			}
+		}
+
+		ReadRun run = { i, i + 1, begin, end, false };
+		runs.push_back(run);
+	}
+}
+
+// orders files by where their data is stored, ties stay in index order
+class ArchiveOrder {
+public:
+	ArchiveOrder(const Vpk::Index &index) : m_index(index) {}
+
+	bool operator () (Vpk::Index::Id a, Vpk::Index::Id b) const {
+		uint16_t archiveA = m_index.archive(a);
+		uint16_t archiveB = m_index.archive(b);
+		return archiveA != archiveB ? archiveA < archiveB : m_index.offset(a) < m_index.offset(b);
+	}
+
+private:
+	const Vpk::Index &m_index;
+};
+
+void Vpk::Package::schedule(std::vector<Index::Id> &files) const {
+	loadAll();
+	files.clear();
+	files.reserve(m_index.files() - m_shadowedFiles);
+	for (Index::Id file = 0, n = m_index.files(); file < n; ++ file) {
+		if (!shadowed(file)) {
+			files.push_back(file);
+		}
+	}
+	if (m_archiveOrder) {
+		std::stable_sort(files.begin(), files.end(), ArchiveOrder(m_index));
+	}
+}
+
+// checksum of a piece of a file, combined when the last one is reported
+struct CrcPiece {
+	uint32_t    crc;
+	std::string error;
+};
+
+// Workers handle whole runs: they create the data handlers (one at a
+// time, factories need not be thread safe) and feed them from a buffer
+// filled with pread(). If the factory batches, small files are instead
+// collected and passed to it at once before the buffer is refilled. If
+// it only checks, big files are hashed in pieces without a handler. The
+// handler is told about the outcome in schedule order.
+void Vpk::Package::process(DataHandlerFactory &factory) const {
+	std::vector<Index::Id> files;
+	schedule(files);
+
+	bool checksOnly = factory.checksOnly();
+	std::vector<ReadRun> runs;
+	planReads(m_index, files, m_readSize, m_readGap, runs, checksOnly ? CRC_PIECE_SIZE : 0);
+	std::vector<CrcPiece> pieces(checksOnly ? runs.size() : 0);
+
+	std::vector<std::string> dirPaths;
+	m_index.dirPaths(dirPaths);
+
+	std::vector<uint16_t> runArchives(runs.size());
+	for (size_t r = 0, n = runs.size(); r < n; ++ r) {
+		runArchives[r] = m_index.archive(files[runs[r].first]);
+	}
+	DeviceQueue queue(*this, runArchives, m_threads, m_deviceThreads);
+
+	std::vector<ProcessWorker> workers(queue.workers());
+	std::vector<ProcessResult> results(files.size());
+	std::mutex factoryMutex;
+	bool batches = factory.batches();
+
+	if (m_handler) m_handler->begin(*this);
+	ordered(runs.size(), queue,
+		[&](size_t worker, size_t r) {
+			const ReadRun &run = runs[r];
+			ProcessWorker &state = workers[worker];
+
+			uint16_t index = m_index.archive(files[run.first]);
+			int fd = openArchive(*this, index, state.archives, state.openErrors);
+
+			if (run.piece) {
+				CrcPiece &piece = pieces[r];
+				if (fd < 0) {
+					piece.error = state.openErrors[index];
+					return;
+				}
+				Crc32 crc;
+				for (uint64_t offset = run.begin; offset < run.end;) {
+					size_t size = std::min(run.end - offset, (uint64_t) m_readSize);
+					state.buffer.resize(std::max(state.buffer.size(), size));
+					if (readAt(fd, &state.buffer[0], size, offset, piece.error) < size) return;
+					crc.process(&state.buffer[0], size);
+					offset += size;
+				}
+				piece.crc = crc.checksum();
+				return;
+			}
+
+			// the batch points into the buffer
+			auto flush = [&]() {
+				if (state.batch.empty()) return;
+				factory.process(state.batch);
+				for (size_t b = 0, n = state.batch.size(); b < n; ++ b) {
+					ProcessResult &result = results[state.batchFiles[b]];
+					if (state.batch[b].error.empty()) {
+						result.status = ProcessResult::OK;
+					}
+					else {
+						result.error.swap(state.batch[b].error);
+					}
+				}
+				state.batch.clear();
+				state.batchFiles.clear();
+			};
+
+			// the buffer holds [bufferBegin, bufferEnd) of the archive
+			uint64_t bufferBegin = 0;
+			uint64_t bufferEnd   = 0;
+			for (size_t i = run.first; i < run.last; ++ i) {
+				Index::Id file = files[i];
+				ProcessResult &result = results[i];
+
+				result.path = dirPaths[m_index.parent(file)];
+				if (!result.path.empty()) result.path += '/';
+				result.path += m_index.name(file);
+				result.status = ProcessResult::FILE_ERROR;
+
+				uint64_t offset = m_index.offset(file);
+				uint64_t end    = offset + m_index.size(file);
+				if (batches && fd >= 0 && end - offset < MIN_COPY_SIZE) {
+					if (end > offset && (offset < bufferBegin || end > bufferEnd)) {
+						flush();
+						size_t size = std::min(std::max(run.end, end) - offset, (uint64_t) m_readSize);
+						state.buffer.resize(std::max(state.buffer.size(), size));
+						bufferBegin = offset;
+						bufferEnd   = offset + readAt(fd, &state.buffer[0], size, offset, result.error);
+						result.error.clear();
+					}
+					// if the read came up short the file goes the usual way
+					if (end == offset || (offset >= bufferBegin && end <= bufferEnd)) {
+						DataEntry entry = {
+							&result.path, m_index.crc32(file),
+							m_index.preload(file), m_index.preloadSize(file),
+							end > offset ? &state.buffer[offset - bufferBegin] : 0, end - offset,
+							std::string()
+						};
+						state.batch.push_back(entry);
+						state.batchFiles.push_back(i);
+						continue;
+					}
+				}
+				flush();
+
+				try {
+					boost::scoped_ptr<DataHandler> dataHandler;
+					{
+						std::lock_guard<std::mutex> lock(factoryMutex);
+						dataHandler.reset(factory.create(result.path, m_index.crc32(file)));
+					}
+
+					size_t preloadSize = m_index.preloadSize(file);
+					dataHandler->reserve(preloadSize + m_index.size(file));
+					if (preloadSize > 0) {
+						dataHandler->process(m_index.preload(file), preloadSize);
+					}
+
+					if (fd < 0) {
+						result.status = ProcessResult::ARCHIVE_ERROR;
+						result.error  = state.openErrors[index];
+						continue;
+					}
+
+					// small files are cheaper to slice out of the run
+					if (end - offset >= MIN_COPY_SIZE && (offset < bufferBegin || offset >= bufferEnd)) {
+						offset += dataHandler->copy(fd, offset, end - offset);
+					}
+					while (offset < end) {
+						if (offset < bufferBegin || offset >= bufferEnd) {
+							size_t size = std::min(std::max(run.end, end) - offset, (uint64_t) m_readSize);
+							state.buffer.resize(std::max(state.buffer.size(), size));
+							bufferBegin = offset;
+							bufferEnd   = offset + readAt(fd, &state.buffer[0], size, offset, result.error);
+							if (bufferEnd == bufferBegin) {
+								result.status = ProcessResult::ARCHIVE_ERROR;
+								break;
+							}
+							result.error.clear();
+						}
+
+						size_t count = std::min(end, bufferEnd) - offset;
+						dataHandler->process(&state.buffer[offset - bufferBegin], count);
+						offset += count;
+					}
+					if (result.status == ProcessResult::ARCHIVE_ERROR) continue;
+
+					dataHandler->finish();
+				}
+				catch (const std::exception &exc) {
+					result.error = exc.what();
+					continue;
+				}
+				result.status = ProcessResult::OK;
+			}
+			flush();
+		},
+		[&](size_t r) {
+			if (runs[r].piece) {
+				size_t i = runs[r].first;
+				if (r + 1 < runs.size() && runs[r + 1].piece && runs[r + 1].first == i) return;
+
+				Index::Id file = files[i];
+				ProcessResult &result = results[i];
+				result.path = dirPaths[m_index.parent(file)];
+				if (!result.path.empty()) result.path += '/';
+				result.path += m_index.name(file);
+				result.status = ProcessResult::OK;
+
+				Crc32 preload;
+				preload.process(m_index.preload(file), m_index.preloadSize(file));
+				uint32_t crc = preload.checksum();
+				size_t p = r;
+				while (p > 0 && runs[p - 1].piece && runs[p - 1].first == i) -- p;
+				for (; p <= r; ++ p) {
+					if (!pieces[p].error.empty()) {
+						result.status = ProcessResult::ARCHIVE_ERROR;
+						result.error.swap(pieces[p].error);
+						break;
+					}
+					crc = Crc32::combine(crc, pieces[p].crc, runs[p].end - runs[p].begin);
+				}
+
+				if (result.status == ProcessResult::OK) {
+					try {
+						CheckingDataHandler::verify(m_index.crc32(file), crc);
+					}
+					catch (const std::exception &exc) {
+						result.status = ProcessResult::FILE_ERROR;
+						result.error  = exc.what();
+					}
+				}
+				report(result, m_index.archive(file));
+				return;
+			}
+
+			for (size_t i = runs[r].first; i < runs[r].last; ++ i) {
+				report(results[i], m_index.archive(files[i]));
+			}
+		});
+	if (m_handler) m_handler->end();
+}
+
+static const unsigned int URING_ENTRIES   = 256;
+static const unsigned int URING_SLOTS     = 128;
+static const size_t       URING_BUFFERS   = 32 * 1024 * 1024;
+static const uint64_t     URING_NO_UNIT   = 0x0fffffff;
+static const int          URING_FLAGS     = O_WRONLY | O_CREAT | O_TRUNC;
+
+// The io_uring backend of extract() and check(). Runs are read in pieces
+// of at most readSize() bytes into a few buffers ahead of the calling
+// thread, which computes the checksums in schedule order. Files that fit
+// into one piece are written with a linked open, write and close, bigger
+// ones are opened directly and written piece by piece.
+class Vpk::Package::UringProcess {
+public:
+	UringProcess(const Package &package, const fs::path *destdir, bool check);
+	~UringProcess();
+
+	void run();
+	void sync() { if (m_dirs) m_dirs->sync(); }
+
+private:
+	enum Op {
+		READ,
+		OPEN,
+		WRITE,
+		CLOSE
+	};
+
+	// a piece of a run, read into one buffer
+	struct Unit {
+		size_t       run;
+		uint64_t     begin;
+		uint64_t     end;
+		int          fd;
+		int          buffer;
+		size_t       got;
+		int          error;
+		unsigned int refs;
+		bool         complete;
+	};
+
+	struct FileState {
+		int          fd;
+		int          slot;
+		unsigned int pending;
+		bool         started;
+		bool         opened;
+		bool         consumed;
+		bool         done;
+		uint64_t     expected;
+		uint64_t     written;
+	};
+
+	static uint64_t tag(Op op, size_t unit, size_t file) {
+		return (uint64_t) op << 60 | (uint64_t) unit << 32 | file;
+	}
+
+	char *buffer(int index) { return m_memory.get() + index * m_bufferSize; }
+
+	void read(size_t u);
+	void consume(size_t u);
+	void start(size_t i, bool whole);
+	void write(size_t i, size_t u, uint64_t from, uint64_t to);
+	void chain(size_t i, size_t u, uint64_t from, uint64_t to);
+	void complete(const Ring::Completion &completion);
+	void release(size_t u);
+	void finish(size_t i);
+	void fail(size_t i, ProcessResult::Status status, const std::string &error, bool force = false);
+	void room(unsigned int count);
+	void waitOne();
+
+	const Package                 &m_package;
+	const Index                   &m_index;
+	const fs::path                *m_destdir;
+	bool                           m_check;
+	std::vector<Index::Id>         m_files;
+	std::vector<ReadRun>           m_runs;
+	std::vector<Unit>              m_units;
+	std::vector<std::string>       m_dirPaths;
+	boost::scoped_ptr<DirCache>    m_dirs;
+	std::vector<ProcessResult>     m_results;
+	std::vector<FileState>         m_states;
+	Archives                       m_archives;
+	boost::unordered_map<uint16_t, std::string> m_openErrors;
+	size_t                         m_next;
+	Crc32                          m_crc;
+	std::vector<std::string>       m_slotPaths;
+	std::vector<unsigned int>      m_freeSlots;
+	size_t                         m_bufferSize;
+	std::vector<int>               m_freeBuffers;
+	bool                           m_fixed;
+	boost::scoped_array<char>      m_memory; // declared before the ring, which drains first
+	Ring                           m_ring;
+};
+
+Vpk::Package::UringProcess::UringProcess(const Package &package, const fs::path *destdir, bool check) :
+	m_package(package), m_index(package.m_index), m_destdir(destdir), m_check(check || !destdir),
+	m_next(0), m_bufferSize(package.m_readSize), m_fixed(false), m_ring(URING_ENTRIES) {
+	package.schedule(m_files);
+	planReads(m_index, m_files, m_bufferSize, package.m_readGap, m_runs);
+
+	// big files are split into several units
+	for (size_t r = 0, n = m_runs.size(); r < n; ++ r) {
+		const ReadRun &run = m_runs[r];
+		uint64_t begin = run.begin;
+		do {
+			Unit unit = { r, begin, std::min(run.end, begin + m_bufferSize), -1, -1, 0, 0, 0, false };
+			m_units.push_back(unit);
+			begin = unit.end;
+		} while (begin < run.end);
+	}
+
+	m_index.dirPaths(m_dirPaths);
+	m_results.resize(m_files.size());
+	FileState state = { -1, -1, 0, false, false, false, false, 0, 0 };
+	m_states.resize(m_files.size(), state);
+
+	size_t count = std::min(m_units.size(), std::max((size_t) 2, URING_BUFFERS / m_bufferSize));
+	m_memory.reset(new char[count * m_bufferSize]);
+	std::vector<struct iovec> buffers(count);
+	for (size_t i = 0; i < count; ++ i) {
+		buffers[i].iov_base = buffer(i);
+		buffers[i].iov_len  = m_bufferSize;
+		m_freeBuffers.push_back(count - i - 1);
+	}
+
+	// registering buffers might exceed the memlock limit
+	try {
+		if (count > 0) {
+			m_ring.registerBuffers(&buffers[0], count);
+			m_fixed = true;
+		}
+	}
+	catch (const IOError&) {}
+
+	if (m_destdir) {
+		m_dirs.reset(new DirCache(*m_destdir));
+
+		// the kernel refuses more slots than the open file limit allows
+		unsigned int slots = URING_SLOTS;
+		struct rlimit limit;
+		if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+			slots = (unsigned int) std::max((rlim_t) 1, std::min((rlim_t) slots, limit.rlim_cur));
+		}
+		for (;;) {
+			try {
+				m_ring.registerFiles(slots);
+				break;
+			}
+			catch (const IOError&) {
+				if (slots == 1) throw;
+				slots /= 2;
+			}
+		}
+		m_slotPaths.resize(slots);
+		for (unsigned int slot = slots; slot > 0; -- slot) {
+			m_freeSlots.push_back(slot - 1);
+		}
+	}
+}
+
+Vpk::Package::UringProcess::~UringProcess() {
+	for (std::vector<FileState>::iterator state = m_states.begin(); state != m_states.end(); ++ state) {
+		if (state->fd >= 0) {
+			::close(state->fd);
+		}
+	}
+}
+
+void Vpk::Package::UringProcess::run() {
+	size_t nextRead = 0;
+	size_t nextUnit = 0;
+	size_t reported = 0;
+
+	if (m_package.m_handler) m_package.m_handler->begin(m_package);
+	while (reported < m_files.size()) {
+		bool progress = false;
+		while (nextRead < m_units.size() && !m_freeBuffers.empty() && m_ring.pending() < m_ring.completionEntries()) {
+			read(nextRead ++);
+			progress = true;
+		}
+		if (nextUnit < nextRead && m_units[nextUnit].complete) {
+			consume(nextUnit ++);
+			progress = true;
+		}
+		m_ring.submit();
+
+		while (reported < m_files.size() && m_states[reported].done) {
+			m_package.report(m_results[reported], m_index.archive(m_files[reported]));
+			++ reported;
+			progress = true;
+		}
+
+		if (!progress) {
+			waitOne();
+		}
+	}
+	if (m_package.m_handler) m_package.m_handler->end();
+}
+
+void Vpk::Package::UringProcess::waitOne() {
+	Ring::Completion completion;
+	m_ring.wait(completion);
+	do {
+		complete(completion);
+	} while (m_ring.peek(completion));
+}
+
+// makes sure count more requests neither overflow the completion queue
+// nor are submitted apart
+void Vpk::Package::UringProcess::room(unsigned int count) {
+	while (m_ring.pending() + count > m_ring.completionEntries()) {
+		waitOne();
+	}
+	m_ring.reserve(count);
+}
+
+void Vpk::Package::UringProcess::read(size_t u) {
+	Unit &unit = m_units[u];
+	uint16_t index = m_index.archive(m_files[m_runs[unit.run].first]);
+	unit.fd = openArchive(m_package, index, m_archives, m_openErrors);
+	if (unit.fd < 0 || unit.begin == unit.end) {
+		unit.complete = true;
+		return;
+	}
+
+	unit.buffer = m_freeBuffers.back();
+	unit.refs   = 1;
+	m_freeBuffers.pop_back();
+	m_ring.read(unit.fd, false, buffer(unit.buffer), unit.end - unit.begin, unit.begin,
+		m_fixed ? unit.buffer : -1, tag(READ, u, 0));
+}
+
+void Vpk::Package::UringProcess::release(size_t u) {
+	Unit &unit = m_units[u];
+	if (-- unit.refs == 0) {
+		m_freeBuffers.push_back(unit.buffer);
+		unit.buffer = -1;
+	}
+}
+
+void Vpk::Package::UringProcess::fail(size_t i, ProcessResult::Status status, const std::string &error, bool force) {
+	ProcessResult &result = m_results[i];
+	if (force || result.status == ProcessResult::OK) {
+		result.status = status;
+		result.error  = error;
+	}
+}
+
+// Feeds the files of the unit's run that have data in it. A file is
+// started by the first unit it has data in and consumed by the last.
+void Vpk::Package::UringProcess::consume(size_t u) {
+	const Unit &unit = m_units[u];
+	const ReadRun &run = m_runs[unit.run];
+	uint64_t available = unit.begin + unit.got;
+
+	std::string error;
+	if (unit.fd < 0) {
+		error = m_openErrors[m_index.archive(m_files[run.first])];
+	}
+	else if (unit.error != 0) {
+		error = IOError(unit.error).what();
+	}
+
+	for (; m_next < run.last; ++ m_next) {
+		size_t i = m_next;
+		Index::Id file = m_files[i];
+		uint64_t begin = m_index.offset(file);
+		uint64_t end   = begin + m_index.size(file);
+		if (begin != end && begin >= unit.end) break;
+
+		FileState &state = m_states[i];
+		bool whole = !state.started && end <= unit.end;
+		if (!state.started) {
+			start(i, whole);
+		}
+
+		uint64_t from = std::max(begin, unit.begin);
+		uint64_t to   = std::min(end, unit.end);
+		uint64_t got  = std::max(from, std::min(to, available));
+		if (m_check && got > from) {
+			m_crc.process(buffer(unit.buffer) + (from - unit.begin), got - from);
+		}
+		if (m_destdir && m_results[i].status == ProcessResult::OK) {
+			if (whole) {
+				chain(i, u, from, got);
+			}
+			else {
+				write(i, u, from, got);
+			}
+		}
+
+		if (unit.fd < 0 || got < to) {
+			fail(i, ProcessResult::ARCHIVE_ERROR, error);
+		}
+		else if (end > unit.end) {
+			// continued by the next unit
+			break;
+		}
+		else if (m_check && m_results[i].status == ProcessResult::OK) {
+			uint32_t sum = m_crc.checksum();
+			if (sum != m_index.crc32(file)) {
+				fail(i, ProcessResult::FILE_ERROR, (boost::format("checksum missmatch, expected 0x%08x, got 0x%08x")
+					% m_index.crc32(file) % sum).str());
+			}
+		}
+
+		state.consumed = true;
+		finish(i);
+	}
+
+	if (unit.buffer >= 0) {
+		release(u);
+	}
+}
+
+// Files that are not whole in one unit are opened right away, the
+// others by chain().
+void Vpk::Package::UringProcess::start(size_t i, bool whole) {
+	Index::Id file = m_files[i];
+	ProcessResult &result = m_results[i];
+	FileState &state = m_states[i];
+
+	Index::Id dir = m_index.parent(file);
+	result.path = m_dirPaths[dir];
+	if (!result.path.empty()) result.path += '/';
+	result.path += m_index.name(file);
+	result.status = ProcessResult::OK;
+	state.started = true;
+
+	size_t preloadSize = m_index.preloadSize(file);
+	if (m_check) {
+		m_crc.reset();
+		if (preloadSize > 0) {
+			m_crc.process(m_index.preload(file), preloadSize);
+		}
+	}
+
+	if (!m_destdir) return;
+
+	// queued opens are relative to the destination directory, as the
+	// cache might close the descriptor of the parent before they run
+	try {
+		if (!m_dirs->created(m_dirPaths[dir])) {
+			m_dirs->dir(m_dirPaths[dir]);
+		}
+		if (!whole) {
+			state.fd = m_dirs->create(result.path);
+			if (preloadSize + m_index.size(file) >= FileDataHandler::RESERVE_SIZE) {
+				FileIO::reserve(state.fd, preloadSize + m_index.size(file));
+			}
+		}
+	}
+	catch (const std::exception &exc) {
+		fail(i, ProcessResult::FILE_ERROR, exc.what());
+		return;
+	}
+
+	if (state.fd >= 0 && preloadSize > 0) {
+		room(1);
+		m_ring.write(state.fd, false, m_index.preload(file), preloadSize, 0, -1, tag(WRITE, URING_NO_UNIT, i));
+		++ state.pending;
+		state.expected += preloadSize;
+	}
+}
+
+// writes [from, to) of the archive to a file opened by start()
+void Vpk::Package::UringProcess::write(size_t i, size_t u, uint64_t from, uint64_t to) {
+	FileState &state = m_states[i];
+	if (state.fd < 0 || to <= from) return;
+
+	Unit &unit = m_units[u];
+	Index::Id file = m_files[i];
+	room(1);
+	m_ring.write(state.fd, false, buffer(unit.buffer) + (from - unit.begin), to - from,
+		m_index.preloadSize(file) + (from - m_index.offset(file)), m_fixed ? unit.buffer : -1, tag(WRITE, u, i));
+	++ unit.refs;
+	++ state.pending;
+	state.expected += to - from;
+}
+
+// Opens a file into a slot of the files table, writes its preload data
+// and [from, to) of the archive and closes it, linked so that nothing
+// runs after a failure. Closing is resubmitted in that case.
+void Vpk::Package::UringProcess::chain(size_t i, size_t u, uint64_t from, uint64_t to) {
+	FileState &state = m_states[i];
+	Index::Id file = m_files[i];
+	size_t preloadSize = m_index.preloadSize(file);
+	unsigned int count = 2 + (preloadSize > 0) + (to > from);
+
+	while (m_freeSlots.empty()) {
+		waitOne();
+	}
+	room(count);
+
+	unsigned int slot = m_freeSlots.back();
+	m_freeSlots.pop_back();
+	state.slot = slot;
+	m_slotPaths[slot] = m_results[i].path;
+	m_slotPaths[slot].erase(0, m_slotPaths[slot].find_first_not_of('/'));
+
+	// files opened into a slot have no descriptor, so no O_CLOEXEC
+	m_ring.openat(m_dirs->root(), m_slotPaths[slot].c_str(), URING_FLAGS, 0666, slot, tag(OPEN, URING_NO_UNIT, i), true);
+	if (preloadSize > 0) {
+		m_ring.write(slot, true, m_index.preload(file), preloadSize, 0, -1, tag(WRITE, URING_NO_UNIT, i), true);
+	}
+	if (to > from) {
+		Unit &unit = m_units[u];
+		m_ring.write(slot, true, buffer(unit.buffer) + (from - unit.begin), to - from, preloadSize,
+			m_fixed ? unit.buffer : -1, tag(WRITE, u, i), true);
+		++ unit.refs;
+	}
+	m_ring.close(slot, tag(CLOSE, URING_NO_UNIT, i));
+
+	state.pending += count;
+	state.expected = preloadSize + (to - from);
+}
+
+void Vpk::Package::UringProcess::complete(const Ring::Completion &completion) {
+	Op op = (Op) (completion.data >> 60);
+	size_t u = (completion.data >> 32) & URING_NO_UNIT;
+	size_t i = completion.data & 0xffffffff;
+	int32_t result = completion.result;
+
+	if (op == READ) {
+		Unit &unit = m_units[u];
+		if (result < 0) {
+			unit.error = -result;
+		}
+		else if (result == 0) {
+			unit.error = EOF;
+		}
+		else {
+			unit.got += result;
+			if (unit.got < unit.end - unit.begin) {
+				m_ring.read(unit.fd, false, buffer(unit.buffer) + unit.got, unit.end - unit.begin - unit.got,
+					unit.begin + unit.got, m_fixed ? unit.buffer : -1, completion.data);
+				return;
+			}
+		}
+		unit.complete = true;
+		return;
+	}
+
+	FileState &state = m_states[i];
+	switch (op) {
+	case OPEN:
+		// failing to create the file is reported over anything else
+		if (result < 0) {
+			fail(i, ProcessResult::FILE_ERROR, IOError(-result).what(), true);
+		}
+		else {
+			state.opened = true;
+		}
+		break;
+
+	case WRITE:
+		if (u != URING_NO_UNIT) {
+			release(u);
+		}
+		if (result >= 0) {
+			state.written += result;
+		}
+		else if (result != -ECANCELED) {
+			fail(i, ProcessResult::FILE_ERROR, IOError(-result).what());
+		}
+		break;
+
+	case CLOSE:
+		if (result == -ECANCELED && state.opened) {
+			state.opened = false;
+			m_ring.close(state.slot, completion.data);
+			return;
+		}
+		if (result < 0 && result != -ECANCELED) {
+			fail(i, ProcessResult::FILE_ERROR, IOError(-result).what());
+		}
+		m_freeSlots.push_back(state.slot);
+		state.slot = -1;
+		break;
+
+	default:
+		break;
+	}
+
+	-- state.pending;
+	finish(i);
+}
+
+// A file is done once it is consumed and nothing is pending for it.
+// Writes only fall short if the disk is full.
+void Vpk::Package::UringProcess::finish(size_t i) {
+	FileState &state = m_states[i];
+	if (!state.consumed || state.pending > 0 || state.done) return;
+
+	if (state.fd >= 0) {
+		if (::close(state.fd) != 0) {
+			fail(i, ProcessResult::FILE_ERROR, IOError(errno).what());
+		}
+		state.fd = -1;
+	}
+	if (state.written != state.expected) {
+		fail(i, ProcessResult::FILE_ERROR, IOError(ENOSPC).what());
+	}
+	state.done = true;
+}
+
+static const size_t PIPELINE_BUFFERS = 32 * 1024 * 1024;
+
+// The pipelined backend of extract() and check(). Runs are read in
+// pieces of at most readSize() bytes, each into one of a few buffers
+// that go round from the reader to the checker to the writer and back.
+// The checker and the writer both walk the schedule along the pieces.
+class Vpk::Package::Pipeline {
+public:
+	Pipeline(const Package &package, DataHandlerFactory *factory, bool check);
+	~Pipeline() { stop(); }
+
+	void run();
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	// a piece of a run, read into one buffer
+	struct Unit {
+		size_t      run;
+		uint64_t    begin;
+		uint64_t    end;
+		int         buffer;
+		bool        opened; // the archive
+		size_t      got;
+		std::string error;
+	};
+
+	// time a stage ran and spent waiting for the others
+	struct Stage {
+		const char       *name;
+		Clock::time_point begin;
+		Clock::duration   total;
+		Clock::duration   waited;
+	};
+
+	// the file a stage is at and whether it was started
+	struct Cursor {
+		size_t file;
+		bool   started;
+	};
+
+	char *buffer(int index) { return m_memory.get() + index * m_bufferSize; }
+
+	template<typename Attempt> bool wait(Stage &stage, Attempt attempt);
+	template<typename Start, typename Data, typename Finish>
+	void walk(const Unit &unit, Cursor &cursor, Start start, Data data, Finish finish);
+
+	void read();
+	void checksums();
+	void write();
+	void guard(Stage &stage, void (Pipeline::*work)());
+	void stop();
+
+	const Package                 &m_package;
+	const Index                   &m_index;
+	DataHandlerFactory            *m_factory;
+	bool                           m_check;
+	std::vector<Index::Id>         m_files;
+	std::vector<ReadRun>           m_runs;
+	std::vector<Unit>              m_units;
+	std::vector<uint32_t>          m_sums;
+	size_t                         m_bufferSize;
+	boost::scoped_array<char>      m_memory;
+	SpscQueue<size_t>              m_read;    // units read, to check
+	SpscQueue<size_t>              m_checked; // units checked, to write
+	SpscQueue<int>                 m_free;    // buffers written, to read into
+	Stage                          m_stages[3];
+	std::atomic<bool>              m_stop;
+	std::exception_ptr             m_error; // of the other threads, set before m_stop
+	std::vector<std::thread>       m_threads;
+};
+
+Vpk::Package::Pipeline::Pipeline(const Package &package, DataHandlerFactory *factory, bool check) :
+	m_package(package), m_index(package.m_index), m_factory(factory), m_check(check),
+	m_bufferSize(package.m_readSize),
+	m_read(std::max((size_t) 2, PIPELINE_BUFFERS / package.m_readSize)),
+	m_checked(m_read.capacity()), m_free(m_read.capacity()), m_stop(false) {
+	package.schedule(m_files);
+	planReads(m_index, m_files, m_bufferSize, package.m_readGap, m_runs);
+
+	// big files are split into several units
+	for (size_t r = 0, n = m_runs.size(); r < n; ++ r) {
+		const ReadRun &run = m_runs[r];
+		uint64_t begin = run.begin;
+		do {
+			Unit unit = { r, begin, std::min(run.end, begin + m_bufferSize), -1, false, 0, std::string() };
+			m_units.push_back(unit);
+			begin = unit.end;
+		} while (begin < run.end);
+	}
+	m_sums.resize(m_files.size());
+
+	size_t count = std::min(m_units.size(), m_free.capacity());
+	m_memory.reset(new char[count * m_bufferSize]);
+	for (size_t i = 0; i < count; ++ i) {
+		m_free.push(i);
+	}
+
+	const char *names[] = { "read", "check", factory ? "write" : "report" };
+	for (int i = 0; i < 3; ++ i) {
+		Stage stage = { names[i], Clock::time_point(), Clock::duration::zero(), Clock::duration::zero() };
+		m_stages[i] = stage;
+	}
+}
+
+// Calls attempt() until it succeeds, first yielding to the other stages
+// and then sleeping a bit. Returns false if the pipeline was stopped.
+template<typename Attempt>
+bool Vpk::Package::Pipeline::wait(Stage &stage, Attempt attempt) {
+	if (attempt()) return true;
+
+	Clock::time_point begin = Clock::now();
+	bool ok = true;
+	for (unsigned int tries = 0; !attempt(); ++ tries) {
+		if (m_stop) {
+			ok = false;
+			break;
+		}
+		if (tries < 16) {
+			std::this_thread::yield();
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+	}
+	stage.waited += Clock::now() - begin;
+	return ok;
+}
+
+// Passes the files of unit's run to start(i) and finish(i) in schedule
+// order and the parts of their data within unit to data(i, from, to).
+// Files continued in the next unit are not finished yet.
+template<typename Start, typename Data, typename Finish>
+void Vpk::Package::Pipeline::walk(const Unit &unit, Cursor &cursor, Start start, Data data, Finish finish) {
+	const ReadRun &run = m_runs[unit.run];
+	if (unit.begin == run.begin) {
+		cursor.file    = run.first;
+		cursor.started = false;
+	}
+	for (; cursor.file < run.last; ++ cursor.file, cursor.started = false) {
+		size_t i = cursor.file;
+		uint64_t begin = m_index.offset(m_files[i]);
+		uint64_t end   = begin + m_index.size(m_files[i]);
+
+		if (!cursor.started) {
+			start(i);
+			cursor.started = true;
+		}
+		if (begin < end) {
+			uint64_t from = std::max(begin, unit.begin);
+			uint64_t to   = std::min(end, unit.end);
+			if (from < to) data(i, from, to);
+			if (end > unit.end) break;
+		}
+		finish(i);
+	}
+}
+
+void Vpk::Package::Pipeline::read() {
+	Archives archives;
+	boost::unordered_map<uint16_t, std::string> openErrors;
+	Stage &stage = m_stages[0];
+
+	for (size_t u = 0, n = m_units.size(); u < n; ++ u) {
+		Unit &unit = m_units[u];
+		if (!wait(stage, [&]() { return m_free.pop(unit.buffer); })) return;
+
+		uint16_t index = m_index.archive(m_files[m_runs[unit.run].first]);
+		int fd = openArchive(m_package, index, archives, openErrors);
+		unit.opened = fd >= 0;
+		if (fd < 0) {
+			unit.error = openErrors[index];
+		}
+		else if (unit.begin < unit.end) {
+			unit.got = readAt(fd, buffer(unit.buffer), unit.end - unit.begin, unit.begin, unit.error);
+		}
+
+		if (!wait(stage, [&]() { return m_read.push(u); })) return;
+	}
+}
+
+void Vpk::Package::Pipeline::checksums() {
+	Stage &stage = m_stages[1];
+	Crc32 crc;
+	Cursor cursor = { 0, false };
+
+	for (size_t u = 0, n = m_units.size(); u < n; ++ u) {
+		size_t next;
+		if (!wait(stage, [&]() { return m_read.pop(next); })) return;
+		const Unit &unit = m_units[next];
+
+		// data missing from the buffer fails the file in write()
+		if (m_check) walk(unit, cursor,
+			[&](size_t i) {
+				crc.reset();
+				crc.process(m_index.preload(m_files[i]), m_index.preloadSize(m_files[i]));
+			},
+			[&](size_t, uint64_t from, uint64_t to) {
+				if (to <= unit.begin + unit.got) {
+					crc.process(buffer(unit.buffer) + (from - unit.begin), to - from);
+				}
+			},
+			[&](size_t i) { m_sums[i] = crc.checksum(); });
+
+		if (!wait(stage, [&]() { return m_checked.push(next); })) return;
+	}
+}
+
+void Vpk::Package::Pipeline::write() {
+	std::vector<std::string> dirPaths;
+	m_index.dirPaths(dirPaths);
+
+	Stage &stage = m_stages[2];
+	boost::scoped_ptr<DataHandler> handler;
+	ProcessResult result;
+	bool failed = false;
+	Cursor cursor = { 0, false };
+
+	for (size_t u = 0, n = m_units.size(); u < n; ++ u) {
+		size_t next;
+		if (!wait(stage, [&]() { return m_checked.pop(next); })) break;
+		const Unit &unit = m_units[next];
+
+		walk(unit, cursor,
+			[&](size_t i) {
+				Index::Id file = m_files[i];
+				result.path = dirPaths[m_index.parent(file)];
+				if (!result.path.empty()) result.path += '/';
+				result.path += m_index.name(file);
+				result.status = ProcessResult::FILE_ERROR;
+				failed = false;
+
+				try {
+					if (m_factory) {
+						handler.reset(m_factory->create(result.path, m_index.crc32(file)));
+						size_t preloadSize = m_index.preloadSize(file);
+						handler->reserve(preloadSize + m_index.size(file));
+						if (preloadSize > 0) {
+							handler->process(m_index.preload(file), preloadSize);
+						}
+					}
+				}
+				catch (const std::exception &exc) {
+					result.error = exc.what();
+					handler.reset();
+					failed = true;
+					return;
+				}
+
+				// even files without data fail with their archive
+				if (!unit.opened) {
+					result.status = ProcessResult::ARCHIVE_ERROR;
+					result.error  = unit.error;
+					handler.reset();
+					failed = true;
+				}
+			},
+			[&](size_t, uint64_t from, uint64_t to) {
+				if (failed) return;
+				// like the worker pool the handler gets what could be read
+				uint64_t got = std::min(to, unit.begin + unit.got);
+				if (handler && from < got) {
+					try {
+						handler->process(buffer(unit.buffer) + (from - unit.begin), got - from);
+					}
+					catch (const std::exception &exc) {
+						result.error = exc.what();
+						handler.reset();
+						failed = true;
+						return;
+					}
+				}
+				if (got < to) {
+					result.status = ProcessResult::ARCHIVE_ERROR;
+					result.error  = unit.error;
+					handler.reset();
+					failed = true;
+				}
+			},
+			[&](size_t i) {
+				if (!failed) {
+					try {
+						if (handler) {
+							handler->finish();
+							handler.reset();
+						}
+						if (m_check) CheckingDataHandler::verify(m_index.crc32(m_files[i]), m_sums[i]);
+						result.status = ProcessResult::OK;
+					}
+					catch (const std::exception &exc) {
+						result.error = exc.what();
+					}
+				}
+				handler.reset();
+				m_package.report(result, m_index.archive(m_files[i]));
+			});
+
+		m_free.push(unit.buffer);
+	}
+
+	if (m_stop && m_error) {
+		std::rethrow_exception(m_error);
+	}
+}
+
+// runs work, stopping the pipeline if it throws
+void Vpk::Package::Pipeline::guard(Stage &stage, void (Pipeline::*work)()) {
+	stage.begin = Clock::now();
+	try {
+		(this->*work)();
+	}
+	catch (...) {
+		m_error = std::current_exception();
+		m_stop  = true;
+	}
+	stage.total = Clock::now() - stage.begin;
+}
+
+void Vpk::Package::Pipeline::stop() {
+	m_stop = true;
+	for (std::vector<std::thread>::iterator i = m_threads.begin(); i != m_threads.end(); ++ i) {
+		if (i->joinable()) i->join();
+	}
+}
+
+void Vpk::Package::Pipeline::run() {
+	Handler *handler = m_package.m_handler;
+	if (handler) handler->begin(m_package);
+
+	Clock::time_point begin = Clock::now();
+	m_threads.push_back(std::thread([this]() { guard(m_stages[0], &Pipeline::read); }));
+	m_threads.push_back(std::thread([this]() { guard(m_stages[1], &Pipeline::checksums); }));
+
+	Stage &stage = m_stages[2];
+	stage.begin = Clock::now();
+	write();
+	stage.total = Clock::now() - stage.begin;
+	stop();
+
+	if (handler) {
+		double total = std::chrono::duration<double>(Clock::now() - begin).count();
+		for (int i = 0; i < 3; ++ i) {
+			handler->stage(m_stages[i].name,
+				std::chrono::duration<double>(m_stages[i].total - m_stages[i].waited).count(), total);
+		}
+		handler->end();
+	}
+}
+
+void Vpk::Package::extract(const std::string &destdir, bool check) const {
+	if (m_uring && Ring::supported()) {
+		fs::path path(destdir);
+		boost::scoped_ptr<UringProcess> uring;
+		try {
+			uring.reset(new UringProcess(*this, &path, check));
+		}
+		catch (const IOError&) {
+			// ring setup can fail on resource limits, use the other backends then
+		}
+		if (uring) {
+			uring->run();
+			if (m_sync) uring->sync();
+			return;
+		}
+	}
+	if (m_pipeline) {
+		// the checksums are computed by their own stage
+		FileDataHandlerFactory factory(destdir, false, m_sync);
+		Pipeline(*this, &factory, check).run();
+		if (m_sync) factory.sync();
+		return;
+	}
+	FileDataHandlerFactory factory(destdir, check, m_sync);
+	process(factory);
+	if (m_sync) factory.sync();
+}
+
+void Vpk::Package::copy(const File &file, FileIO &out, Archives &archives) const {
+	if (file.preloadSize() > 0) {
+		out.write(file.preload(), file.preloadSize());
+	}
+
+	size_t size = file.size();
+	if (size == 0) return;
+
+	boost::shared_ptr<FileIO> &archive = archives[file.index()];
+	if (!archive) {
+		archive.reset(new FileIO(archivePath(file.index()), "rb"));
+	}
+
+	size_t done = out.writeFrom(archive->fileno(), file.offset(), size);
+	if (done < size) {
+		archive->seek(file.offset() + done, FileIO::SET);
+		archive->read(out, size - done);
+	}
+}
+
+void Vpk::Package::check() const {
+	if (m_uring && Ring::supported()) {
+		boost::scoped_ptr<UringProcess> uring;
+		try {
+			uring.reset(new UringProcess(*this, 0, true));
+		}
+		catch (const IOError&) {
+			// ring setup can fail on resource limits, use the other backends then
+		}
+		if (uring) {
+			uring->run();
+			return;
+		}
+	}
+	if (m_pipeline) {
+		Pipeline(*this, 0, true).run();
+		return;
+	}
+	CheckingDataHandlerFactory factory;
+	process(factory);
+}
@@ -0,0 +1,325 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef __linux__
+#	include <sys/syscall.h>
+#	include <linux/io_uring.h>
+#endif
+
+#include <vpk/ring.h>
+#include <vpk/io_error.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *params) {
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned int submit, unsigned int wait, unsigned int flags) {
+	return syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, const void *arg, unsigned int count) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+Vpk::Ring::Ring(unsigned int entries) :
+	m_fd(-1), m_features(0), m_sqRing(MAP_FAILED), m_sqRingSize(0), m_cqRing(MAP_FAILED), m_cqRingSize(0),
+	m_sqes((struct io_uring_sqe*) MAP_FAILED), m_sqesSize(0), m_tail(0), m_queued(0), m_pending(0) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	m_fd = io_uring_setup(entries, &params);
+	if (m_fd < 0) {
+		throw IOError(errno);
+	}
+	m_features = params.features;
+
+	try {
+		m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+		m_cqRingSize = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+		if (m_features & IORING_FEAT_SINGLE_MMAP) {
+			m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+		}
+
+		m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+		if (m_sqRing == MAP_FAILED) {
+			throw IOError(errno);
+		}
+
+		if (m_features & IORING_FEAT_SINGLE_MMAP) {
+			m_cqRing = m_sqRing;
+		}
+		else {
+			m_cqRing = mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+			if (m_cqRing == MAP_FAILED) {
+				throw IOError(errno);
+			}
+		}
+
+		m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		m_sqes = (struct io_uring_sqe*) mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+		if (m_sqes == MAP_FAILED) {
+			throw IOError(errno);
+		}
+	}
+	catch (...) {
+		unmap();
+		throw;
+	}
+
+	char *sq = (char*) m_sqRing;
+	char *cq = (char*) m_cqRing;
+	m_sqHead    = (unsigned int*) (sq + params.sq_off.head);
+	m_sqTail    = (unsigned int*) (sq + params.sq_off.tail);
+	m_sqArray   = (unsigned int*) (sq + params.sq_off.array);
+	m_sqMask    = *(unsigned int*) (sq + params.sq_off.ring_mask);
+	m_sqEntries = params.sq_entries;
+	m_cqHead    = (unsigned int*) (cq + params.cq_off.head);
+	m_cqTail    = (unsigned int*) (cq + params.cq_off.tail);
+	m_cqMask    = *(unsigned int*) (cq + params.cq_off.ring_mask);
+	m_cqEntries = params.cq_entries;
+	m_cqes      = cq + params.cq_off.cqes;
+
+	// every entry always uses the submission queue entry of the same index
+	m_tail = *m_sqTail;
+	for (unsigned int i = 0; i < m_sqEntries; ++ i) {
+		m_sqArray[i] = i;
+	}
+}
+
+// In flight requests might still use memory of the caller, so they are
+// waited for.
+Vpk::Ring::~Ring() {
+	Completion completion;
+	try {
+		while (m_pending > 0) {
+			wait(completion);
+		}
+	}
+	catch (...) {}
+	unmap();
+}
+
+void Vpk::Ring::unmap() {
+	if (m_sqes != MAP_FAILED) {
+		munmap(m_sqes, m_sqesSize);
+	}
+	if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) {
+		munmap(m_cqRing, m_cqRingSize);
+	}
+	if (m_sqRing != MAP_FAILED) {
+		munmap(m_sqRing, m_sqRingSize);
+	}
+	if (m_fd >= 0) {
+		::close(m_fd);
+	}
+}
+
+bool Vpk::Ring::probe() {
+	static const uint8_t OPS[] = {
+		IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_WRITE, IORING_OP_WRITE_FIXED,
+		IORING_OP_OPENAT, IORING_OP_CLOSE
+	};
+
+	try {
+		Ring ring(8);
+
+		// openat() into a slot followed by a linked write to that slot
+		// needs the file assignment of linked requests to be deferred
+		if (!(ring.m_features & IORING_FEAT_NODROP) || !(ring.m_features & IORING_FEAT_LINKED_FILE)) {
+			return false;
+		}
+
+		std::vector<char> buffer(sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op), 0);
+		struct io_uring_probe *probe = (struct io_uring_probe*) &buffer[0];
+		if (io_uring_register(ring.m_fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+			return false;
+		}
+		for (size_t i = 0; i < sizeof(OPS); ++ i) {
+			if (OPS[i] > probe->last_op || !(probe->ops[OPS[i]].flags & IO_URING_OP_SUPPORTED)) {
+				return false;
+			}
+		}
+
+		ring.registerFiles(1);
+		return true;
+	}
+	catch (const IOError&) {
+		return false;
+	}
+}
+
+bool Vpk::Ring::supported() {
+	static const bool supported = probe();
+	return supported;
+}
+
+void Vpk::Ring::registerBuffers(const struct iovec *buffers, unsigned int count) {
+	if (io_uring_register(m_fd, IORING_REGISTER_BUFFERS, buffers, count) < 0) {
+		throw IOError(errno);
+	}
+}
+
+void Vpk::Ring::registerFiles(unsigned int count) {
+	std::vector<int> fds(count, -1);
+	if (io_uring_register(m_fd, IORING_REGISTER_FILES, &fds[0], count) < 0) {
+		throw IOError(errno);
+	}
+}
+
+void Vpk::Ring::reserve(unsigned int count) {
+	unsigned int head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+	if (m_sqEntries - (m_tail - head) < count) {
+		submit();
+	}
+}
+
+struct io_uring_sqe *Vpk::Ring::next(uint8_t opcode, uint64_t data, bool link) {
+	reserve(1);
+
+	struct io_uring_sqe *sqe = &m_sqes[m_tail & m_sqMask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode    = opcode;
+	sqe->user_data = data;
+	if (link) {
+		sqe->flags |= IOSQE_IO_LINK;
+	}
+
+	++ m_tail;
+	++ m_queued;
+	++ m_pending;
+	return sqe;
+}
+
+void Vpk::Ring::read(int fd, bool fixed, char *buffer, size_t length, uint64_t offset, int bufferIndex, uint64_t data, bool link) {
+	struct io_uring_sqe *sqe = next(bufferIndex < 0 ? IORING_OP_READ : IORING_OP_READ_FIXED, data, link);
+	sqe->fd   = fd;
+	sqe->addr = (uintptr_t) buffer;
+	sqe->len  = length;
+	sqe->off  = offset;
+	if (fixed) {
+		sqe->flags |= IOSQE_FIXED_FILE;
+	}
+	if (bufferIndex >= 0) {
+		sqe->buf_index = bufferIndex;
+	}
+}
+
+void Vpk::Ring::write(int fd, bool fixed, const char *buffer, size_t length, uint64_t offset, int bufferIndex, uint64_t data, bool link) {
+	struct io_uring_sqe *sqe = next(bufferIndex < 0 ? IORING_OP_WRITE : IORING_OP_WRITE_FIXED, data, link);
+	sqe->fd   = fd;
+	sqe->addr = (uintptr_t) buffer;
+	sqe->len  = length;
+	sqe->off  = offset;
+	if (fixed) {
+		sqe->flags |= IOSQE_FIXED_FILE;
+	}
+	if (bufferIndex >= 0) {
+		sqe->buf_index = bufferIndex;
+	}
+}
+
+void Vpk::Ring::openat(int dirfd, const char *path, int flags, mode_t mode, unsigned int slot, uint64_t data, bool link) {
+	struct io_uring_sqe *sqe = next(IORING_OP_OPENAT, data, link);
+	sqe->fd         = dirfd;
+	sqe->addr       = (uintptr_t) path;
+	sqe->len        = mode;
+	sqe->open_flags = flags;
+	sqe->file_index = slot + 1;
+}
+
+void Vpk::Ring::close(unsigned int slot, uint64_t data, bool link) {
+	struct io_uring_sqe *sqe = next(IORING_OP_CLOSE, data, link);
+	sqe->file_index = slot + 1;
+}
+
+void Vpk::Ring::enter(unsigned int submit, unsigned int wait) {
+	__atomic_store_n(m_sqTail, m_tail, __ATOMIC_RELEASE);
+	for (;;) {
+		int count = io_uring_enter(m_fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			throw IOError(errno);
+		}
+		submit -= std::min((unsigned int) count, submit);
+		m_queued = submit;
+		if (submit == 0) break;
+	}
+}
+
+void Vpk::Ring::submit() {
+	if (m_queued > 0) {
+		enter(m_queued, 0);
+	}
+}
+
+bool Vpk::Ring::peek(Completion &completion) {
+	unsigned int head = *m_cqHead;
+	if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+
+	const struct io_uring_cqe *cqe = (const struct io_uring_cqe*) m_cqes + (head & m_cqMask);
+	completion.data   = cqe->user_data;
+	completion.result = cqe->res;
+	__atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+	-- m_pending;
+	return true;
+}
+
+void Vpk::Ring::wait(Completion &completion) {
+	while (!peek(completion)) {
+		enter(m_queued, 1);
+	}
+}
+
+#else
+
+Vpk::Ring::Ring(unsigned int) : m_fd(-1) {
+	throw IOError(ENOSYS);
+}
+
+Vpk::Ring::~Ring() {}
+void Vpk::Ring::unmap() {}
+
+bool Vpk::Ring::probe()     { return false; }
+bool Vpk::Ring::supported() { return false; }
+
+void Vpk::Ring::registerBuffers(const struct iovec*, unsigned int) { throw IOError(ENOSYS); }
+void Vpk::Ring::registerFiles(unsigned int) { throw IOError(ENOSYS); }
+void Vpk::Ring::reserve(unsigned int) { throw IOError(ENOSYS); }
+void Vpk::Ring::read(int, bool, char*, size_t, uint64_t, int, uint64_t, bool) { throw IOError(ENOSYS); }
+void Vpk::Ring::write(int, bool, const char*, size_t, uint64_t, int, uint64_t, bool) { throw IOError(ENOSYS); }
+void Vpk::Ring::openat(int, const char*, int, mode_t, unsigned int, uint64_t, bool) { throw IOError(ENOSYS); }
+void Vpk::Ring::close(unsigned int, uint64_t, bool) { throw IOError(ENOSYS); }
+void Vpk::Ring::submit() { throw IOError(ENOSYS); }
+bool Vpk::Ring::peek(Completion&) { throw IOError(ENOSYS); }
+void Vpk::Ring::wait(Completion&) { throw IOError(ENOSYS); }
+
+#endif
@@ -0,0 +1,48 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <vpk/tar_data_handler.h>
+#include <vpk/exception.h>
+
+Vpk::TarDataHandler::~TarDataHandler() {
+	// keeps the stream intact if the file could not be read completely
+	if (m_lock.owns_lock()) {
+		try {
+			m_tar.end();
+		}
+		catch (...) {}
+	}
+}
+
+void Vpk::TarDataHandler::reserve(uint64_t size) {
+	m_lock.lock();
+	m_tar.begin(path(), size);
+}
+
+Vpk::TarWriter &Vpk::TarDataHandler::tar() {
+	if (!m_lock.owns_lock()) {
+		throw Exception("size of tar entry not known before its data");
+	}
+	return m_tar;
+}
+
+void Vpk::TarDataHandler::finish() {
+	tar().end();
+	m_lock.unlock();
+	if (m_check) super_type::finish();
+}
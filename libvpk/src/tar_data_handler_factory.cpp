@@ -0,0 +1,35 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <vpk/tar_data_handler_factory.h>
+
+void Vpk::TarDataHandlerFactory::process(std::vector<DataEntry> &entries) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (std::vector<DataEntry>::iterator entry = entries.begin(); entry != entries.end(); ++ entry) {
+		try {
+			m_tar.begin(*entry->path, entry->preloadSize + entry->size);
+			m_tar.write(entry->preload, entry->preloadSize);
+			m_tar.write(entry->data, entry->size);
+			m_tar.end();
+			if (m_check) CheckingDataHandler::check(*entry);
+		}
+		catch (const std::exception &exc) {
+			entry->error = exc.what();
+		}
+	}
+}
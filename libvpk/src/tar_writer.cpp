@@ -0,0 +1,213 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <string.h>
+
+#include <algorithm>
+
+#include <boost/format.hpp>
+
+#include <vpk/tar_writer.h>
+#include <vpk/file_io.h>
+#include <vpk/exception.h>
+
+namespace fs = boost::filesystem;
+
+const size_t Vpk::TarWriter::BLOCK_SIZE;
+
+// ustar header fields
+static const size_t NAME_SIZE   = 100;
+static const size_t PREFIX_SIZE = 155;
+
+struct UstarHeader {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+// zeros after size bytes up to the next block
+static uint64_t padding(uint64_t size) {
+	return (Vpk::TarWriter::BLOCK_SIZE - size % Vpk::TarWriter::BLOCK_SIZE) % Vpk::TarWriter::BLOCK_SIZE;
+}
+
+// Whether path fits into the name and prefix fields. If it needs the
+// prefix, slash is where it is split.
+static bool splitUstar(const std::string &path, size_t &slash) {
+	slash = std::string::npos;
+	if (path.size() <= NAME_SIZE) return true;
+	slash = path.rfind('/', PREFIX_SIZE);
+	return slash != std::string::npos && slash + 1 < path.size() && path.size() - slash - 1 <= NAME_SIZE;
+}
+
+// zero padded octal number that fills a field up to its terminating NUL
+static void octal(char *field, size_t size, uint64_t value) {
+	field[size - 1] = '\0';
+	for (size_t i = size - 1; i > 0; -- i, value >>= 3) {
+		field[i - 1] = '0' + (value & 7);
+	}
+}
+
+class FileOutput : public Vpk::TarWriter::Output {
+public:
+	FileOutput(const fs::path &path) : m_io(path, "wb") {}
+	FileOutput(int fd) : m_io(fd, "wb") {}
+
+	void write(const char *buffer, size_t length) { m_io.write(buffer, length); }
+	size_t writeFrom(int fd, uint64_t offset, size_t length) { return m_io.writeFrom(fd, offset, length); }
+	void finish() { m_io.flush(); }
+
+private:
+	Vpk::FileIO m_io;
+};
+
+Vpk::TarWriter::TarWriter(const fs::path &path, time_t mtime) :
+	m_file(new FileOutput(path)), m_output(*m_file), m_mtime(mtime), m_offset(0),
+	m_inFile(false), m_size(0), m_written(0) {}
+
+Vpk::TarWriter::TarWriter(int fd, time_t mtime) :
+	m_file(new FileOutput(fd)), m_output(*m_file), m_mtime(mtime), m_offset(0),
+	m_inFile(false), m_size(0), m_written(0) {}
+
+Vpk::TarWriter::TarWriter(Output &output, time_t mtime) :
+	m_output(output), m_mtime(mtime), m_offset(0), m_inFile(false), m_size(0), m_written(0) {}
+
+void Vpk::TarWriter::output(const char *buffer, size_t length) {
+	m_output.write(buffer, length);
+	m_offset += length;
+}
+
+void Vpk::TarWriter::header(const std::string &name, char type, uint64_t size) {
+	UstarHeader header;
+	memset(&header, 0, sizeof(header));
+
+	size_t slash;
+	if (!splitUstar(name, slash)) {
+		throw Exception("path too long for a ustar header: " + name);
+	}
+	else if (slash == std::string::npos) {
+		memcpy(header.name, name.c_str(), name.size());
+	}
+	else {
+		memcpy(header.prefix, name.c_str(), slash);
+		memcpy(header.name, name.c_str() + slash + 1, name.size() - slash - 1);
+	}
+
+	octal(header.mode,  sizeof(header.mode),  0644);
+	octal(header.uid,   sizeof(header.uid),   0);
+	octal(header.gid,   sizeof(header.gid),   0);
+	octal(header.size,  sizeof(header.size),  size);
+	octal(header.mtime, sizeof(header.mtime), m_mtime > 0 ? m_mtime : 0);
+	header.typeflag = type;
+	memcpy(header.magic, "ustar", 6);
+	memcpy(header.version, "00", 2);
+
+	// the checksum is computed with the checksum field set to spaces
+	memset(header.chksum, ' ', sizeof(header.chksum));
+	unsigned int sum = 0;
+	const unsigned char *bytes = (const unsigned char*) &header;
+	for (size_t i = 0; i < sizeof(header); ++ i) {
+		sum += bytes[i];
+	}
+	octal(header.chksum, 7, sum);
+
+	output((const char*) &header, sizeof(header));
+}
+
+void Vpk::TarWriter::begin(const std::string &path, uint64_t size) {
+	if (m_inFile) end();
+
+	size_t slash;
+	if (splitUstar(path, slash)) {
+		header(path, '0', size);
+	}
+	else {
+		// "LEN path=PATH\n" where LEN counts the whole record
+		size_t length = path.size() + 8;
+		std::string record;
+		for (;;) {
+			record = (boost::format("%u path=%s\n") % length % path).str();
+			if (record.size() == length) break;
+			length = record.size();
+		}
+		header("././@PaxHeader", 'x', record.size());
+		output(record.c_str(), record.size());
+		pad(padding(record.size()));
+
+		// for tools without pax support
+		header(path.substr(path.size() - NAME_SIZE), '0', size);
+	}
+
+	m_output.entry(path, m_offset, size);
+	m_inFile  = true;
+	m_size    = size;
+	m_written = 0;
+}
+
+void Vpk::TarWriter::wrote(uint64_t count) {
+	if (count > m_size - m_written) {
+		throw Exception("more data than the size of the tar entry");
+	}
+	m_written += count;
+}
+
+void Vpk::TarWriter::write(const char *buffer, size_t length) {
+	wrote(length);
+	if (length > 0) output(buffer, length);
+}
+
+size_t Vpk::TarWriter::writeFrom(int fd, uint64_t offset, size_t length) {
+	size_t count = m_output.writeFrom(fd, offset, std::min((uint64_t) length, remaining()));
+	m_written += count;
+	m_offset  += count;
+	return count;
+}
+
+void Vpk::TarWriter::pad(uint64_t count) {
+	static const char zeros[BLOCK_SIZE] = {0};
+	while (count > 0) {
+		size_t chunk = std::min(count, (uint64_t) BLOCK_SIZE);
+		output(zeros, chunk);
+		count -= chunk;
+	}
+}
+
+void Vpk::TarWriter::end() {
+	if (!m_inFile) return;
+	m_inFile = false;
+	pad(m_size - m_written + padding(m_size));
+}
+
+void Vpk::TarWriter::finish() {
+	end();
+	pad(2 * BLOCK_SIZE);
+	m_output.finish();
+}
@@ -0,0 +1,96 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+
+#include <vector>
+
+#include <boost/crc.hpp>
+
+#include <vpk/crc32.h>
+
+// Crc32::combine() over the pieces of a split has to give the same
+// checksum as boost::crc_32_type over the whole data, bit for bit.
+
+static int failed = 0;
+static int checked = 0;
+
+// cuts are the ends of the pieces, the last one is the length
+static void check(const std::vector<char> &data, const std::vector<size_t> &cuts) {
+	size_t length = cuts.empty() ? 0 : cuts.back();
+
+	boost::crc_32_type expected;
+	expected.process_bytes(data.data(), length);
+
+	uint32_t crc = 0; // of nothing
+	size_t offset = 0;
+	for (size_t i = 0; i < cuts.size(); ++ i) {
+		Vpk::Crc32 piece;
+		piece.process(data.data() + offset, cuts[i] - offset);
+		crc = Vpk::Crc32::combine(crc, piece.checksum(), cuts[i] - offset);
+		offset = cuts[i];
+	}
+
+	++ checked;
+	if (crc != expected.checksum()) {
+		++ failed;
+		printf("length %zu in %zu pieces: got 0x%08x, expected 0x%08x\n",
+			length, cuts.size(), crc, expected.checksum());
+	}
+}
+
+int main() {
+	std::vector<char> data(3 * 1024 * 1024 + 17);
+	uint32_t state = 1;
+	for (size_t i = 0; i < data.size(); ++ i) {
+		state = state * 1103515245 + 12345;
+		data[i] = state >> 16;
+	}
+
+	static const size_t lengths[] = {0, 1, 15, 100, 4096, 65537, 3 * 1024 * 1024 + 17};
+	static const size_t splits[]  = {1, 2, 3, 7, 64};
+
+	for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++ l) {
+		size_t length = lengths[l];
+		for (size_t s = 0; s < sizeof(splits) / sizeof(splits[0]); ++ s) {
+			size_t pieces = splits[s];
+
+			// even pieces, short data gives empty ones
+			std::vector<size_t> cuts;
+			for (size_t i = 1; i <= pieces; ++ i) {
+				cuts.push_back(length * i / pieces);
+			}
+			check(data, cuts);
+
+			// uneven pieces with empty ones at the start, middle and end
+			if (pieces > 1) {
+				cuts.assign(1, 0);
+				for (size_t i = 1; i < pieces - 1; ++ i) {
+					cuts.push_back(length * i * i / (pieces * pieces));
+				}
+				cuts.push_back(cuts.back());
+				cuts.push_back(length);
+				cuts.push_back(length);
+				check(data, cuts);
+			}
+		}
+	}
+
+	printf("%d of %d splits combine correctly\n", checked - failed, checked);
+	return failed == 0 ? 0 : 1;
+}
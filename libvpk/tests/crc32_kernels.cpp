@@ -0,0 +1,97 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+
+#include <vector>
+#include <algorithm>
+
+#include <boost/crc.hpp>
+
+#include <vpk/crc32.h>
+
+// Every kernel the CPU supports has to give the same checksum as
+// boost::crc_32_type, for all the lengths around the block sizes of the
+// kernels, at every alignment and when fed in pieces.
+
+static int failed = 0;
+static int checked = 0;
+
+static void check(Vpk::Crc32::Kernel kernel, const char *data, size_t length, size_t piece) {
+	boost::crc_32_type expected;
+	expected.process_bytes(data, length);
+
+	Vpk::Crc32 crc(kernel);
+	for (size_t offset = 0; offset < length; offset += piece) {
+		crc.process(data + offset, std::min(piece, length - offset));
+	}
+
+	++ checked;
+	if (crc.checksum() != expected.checksum()) {
+		++ failed;
+		printf("%s: length %zu at alignment %zu in pieces of %zu: got 0x%08x, expected 0x%08x\n",
+			Vpk::Crc32::name(kernel), length, (size_t) data % 64, piece,
+			crc.checksum(), expected.checksum());
+	}
+}
+
+int main() {
+	std::vector<char> data(1024 * 1024 + 17 + 128);
+	uint32_t state = 1;
+	for (size_t i = 0; i < data.size(); ++ i) {
+		state = state * 1103515245 + 12345;
+		data[i] = state >> 16;
+	}
+
+	static const Vpk::Crc32::Kernel kernels[] = {
+		Vpk::Crc32::SLICING_BY_16,
+		Vpk::Crc32::PCLMUL,
+		Vpk::Crc32::VPCLMUL
+	};
+	static const size_t lengths[] = {4095, 4096, 4097, 65536 + 63, 1024 * 1024 + 17};
+	static const size_t pieces[]  = {1, 3, 16, 63, 64, 65, 255, 4096};
+
+	// base + align covers every alignment within 64 bytes
+	const char *base = data.data() + (64 - (size_t) data.data() % 64);
+
+	for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++ k) {
+		Vpk::Crc32::Kernel kernel = kernels[k];
+		if (!Vpk::Crc32::supported(kernel)) {
+			printf("%s: not supported\n", Vpk::Crc32::name(kernel));
+			continue;
+		}
+
+		for (size_t align = 0; align < 64; ++ align) {
+			for (size_t length = 0; length <= 512; ++ length) {
+				check(kernel, base + align, length, length > 0 ? length : 1);
+			}
+			for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++ l) {
+				check(kernel, base + align, lengths[l], lengths[l]);
+			}
+		}
+
+		for (size_t p = 0; p < sizeof(pieces) / sizeof(pieces[0]); ++ p) {
+			for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++ l) {
+				check(kernel, base + 1, lengths[l], pieces[p]);
+			}
+		}
+	}
+
+	printf("%d of %d checksums are correct\n", checked - failed, checked);
+	return failed == 0 ? 0 : 1;
+}
@@ -20,7 +20,7 @@
 #define VPK_ARCHIVE_STATS_H
 
 #include <vpk/coverage.h>
-#include <vpk/file.h>
+#include <vpk/index.h>
 
 namespace Vpk {
 	class ArchiveStat {
@@ -34,7 +34,7 @@ namespace Vpk {
 			m_maxSize(0),
 			m_sumSize(0) {}
 
-		void add(const File &file);
+		void add(const Index &index, Index::Id file);
 
 		Coverage &coverage() { return m_coverage; }
 		const Coverage &coverage() const { return m_coverage; }
@@ -20,35 +20,42 @@
 #define VPK_LIST_ENTRY_H
 
 #include <string>
+#include <vector>
 
 #include <boost/format.hpp>
 
-#include <vpk/file.h>
+#include <vpk/index.h>
 #include <vpk/console_table.h>
 
 namespace Vpk {
 	class ListEntry {
 	public:
-		ListEntry(const std::string &path, File *file)
-			: path(path), file(file) {}
+		ListEntry(const std::string &path, const Index &index, Index::Id file)
+			: path(path), index(&index), file(file) {}
 		
 		template<typename SizeFormatter>
 		void insert(ConsoleTable &table, SizeFormatter szfmt) const {
-			size_t size = file->preload.size() + file->size;
-			
-			if (file->size) {
-				table.row(file->index,
-					boost::format("%08x") % file->crc32, szfmt(file->offset), szfmt(size), path);
+			if (index->size(file)) {
+				table.row(index->archive(file),
+					boost::format("%08x") % crc32(), szfmt(index->offset(file)), szfmt(size()), path);
 			}
 			else {
 				table.row("-",
-					boost::format("%08x") % file->crc32, "-", szfmt(size), path);
+					boost::format("%08x") % crc32(), "-", szfmt(size()), path);
 			}
 		}
+
+		uint32_t crc32() const {
+			return index->crc32(file);
+		}
+
+		size_t size() const {
+			return index->preloadSize(file) + index->size(file);
+		}
 	
 		int32_t archive() const {
-			if (file->size) {
-				return file->index;
+			if (index->size(file)) {
+				return index->archive(file);
 			}
 			else {
 				return -1;
@@ -56,16 +63,17 @@ namespace Vpk {
 		}
 	
 		int64_t offset() const {
-			if (file->size) {
-				return file->offset;
+			if (index->size(file)) {
+				return index->offset(file);
 			}
 			else {
 				return -1;
 			}
 		}
 	
-		std::string path;
-		File *file;
+		std::string  path;
+		const Index *index;
+		Index::Id    file;
 	};
 	
 	typedef std::vector<ListEntry> List;
@@ -19,9 +19,9 @@
 
 #include <vpk/archive_stat.h>
 
-void Vpk::ArchiveStat::add(const File &file) {
-	size_t preload = file.preload.size();
-	size_t size = preload + file.size;
+void Vpk::ArchiveStat::add(const Index &index, Index::Id file) {
+	size_t preload = index.preloadSize(file);
+	size_t size = preload + index.size(file);
 	m_sumPreload += preload;
 	m_sumSize    += size;
 	if (m_files == 0) {
@@ -36,5 +36,5 @@ void Vpk::ArchiveStat::add(const File &file) {
 		if (size < m_minSize) m_minSize = size;
 	}
 	++ m_files;
-	m_coverage.add(file.offset, file.size);
+	m_coverage.add(index.offset(file), index.size(file));
 }
@@ -27,6 +27,7 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <vpk.h>
 #include <vpk/util.h>
@@ -58,30 +59,6 @@ static void usage(const po::options_description &desc) {
 		"(c) 2011 Mathias Panzenböck\n";
 }
 
-static void printListing(
-		const Nodes &nodes,
-		const std::vector<std::string> &prefix,
-		List &lst,
-		size_t &files,
-		size_t &dirs,
-		size_t &sumsize) {
-	for (Nodes::const_iterator it = nodes.begin(); it != nodes.end(); ++ it) {
-		Node *node = it->second.get();
-		std::vector<std::string> path(prefix);
-		path.push_back(node->name());
-		if (node->type() == Node::DIR) {
-			printListing(((const Dir*) node)->nodes(), path, lst, files, dirs, sumsize);
-			++ dirs;
-		}
-		else {
-			File *file = (File *) node;
-			lst.push_back(ListEntry(algo::join(path, "/"), file));
-			sumsize += file->preload.size() + file->size;
-			++ files;
-		}
-	}
-}
-
 static size_t bytes(size_t size) {
 	return size;
 }
@@ -100,10 +77,23 @@ static void fillTable(const List &lst, ConsoleTable &table, SizeFormatter szfmt)
 }
 
 static void printListing(const Package &package, bool humanreadable, const SortKeys &sorting) {
+	const Index &index = package.index();
 	List lst;
-	size_t files = 0, dirs = 0, sumsize = 0;
+	size_t files = package.filecount(), dirs = index.dirs() - 1, sumsize = 0;
 
-	printListing(package.nodes(), std::vector<std::string>(), lst, files, dirs, sumsize);
+	std::vector<std::string> dirPaths;
+	index.dirPaths(dirPaths);
+	lst.reserve(files);
+	for (Index::Id file = 0, n = index.files(); file < n; ++ file) {
+		if (package.shadowed(file)) continue;
+
+		std::string path = dirPaths[index.parent(file)];
+		if (!path.empty()) path += '/';
+		path += index.name(file);
+
+		lst.push_back(ListEntry(path, index, file));
+		sumsize += index.preloadSize(file) + index.size(file);
+	}
 
 	if (!sorting.empty()) {
 		Sorter sorter(sorting);
@@ -133,16 +123,11 @@ static void printListing(const Package &package, bool humanreadable, const SortK
 
 typedef std::map<int,ArchiveStat> Stats;
 
-static void archive_stat(const Dir &dir, Stats &stats) {
-	for (Dir::const_iterator i = dir.begin(); i != dir.end(); ++ i) {
-		Node *node = i->second.get();
-		if (node->type() == Node::DIR) {
-			archive_stat(*(Dir*) node, stats);
-		}
-		else {
-			File *file = (File*) node;
-			stats[file->index].add(*file);
-		}
+static void archive_stat(const Package &package, Stats &stats) {
+	const Index &index = package.index();
+	for (Index::Id file = 0, n = index.files(); file < n; ++ file) {
+		if (package.shadowed(file)) continue;
+		stats[index.archive(file)].add(index, file);
 	}
 }
 
@@ -156,7 +141,9 @@ static void printStats(
 
 	Coverage &pkgcov = stats[0x7fff].coverage();
 	pkgcov.add(0, package.dataoff());
-	// TODO: footer?
+	if (package.footerSize() > 0) {
+		pkgcov.add(package.footerOffset(), package.footerSize());
+	}
 
 	std::string prefix = tolower(package.name());
 	prefix += '_';
@@ -298,6 +285,62 @@ static void printStats(
 	sizesTbl.print(std::cout);
 }
 
+static void catFiles(Package &package, const std::vector<std::string> &paths) {
+	// all files are looked up first, so nothing is written if one is missing
+	std::vector<const File*> files;
+	for (std::vector<std::string>::const_iterator path = paths.begin(); path != paths.end(); ++ path) {
+		Node *node = package.get(*path);
+		if (!node || node->type() != Node::FILE) {
+			throw Exception("no such file: \"" + *path + "\"");
+		}
+		files.push_back((const File*) node);
+	}
+
+	// progress goes to stderr so the data stays clean
+	std::cout.rdbuf(std::cerr.rdbuf());
+	FileIO out(STDOUT_FILENO, "wb");
+	Package::Archives archives;
+	for (std::vector<const File*>::const_iterator file = files.begin(); file != files.end(); ++ file) {
+		package.copy(**file, out, archives);
+	}
+	out.flush();
+}
+
+static bool parseArchive(const std::string &str, unsigned int &index) {
+	try {
+		index = lexical_cast<unsigned int>(str);
+	}
+	catch (const boost::bad_lexical_cast&) {
+		return false;
+	}
+	return index <= 0x7fff;
+}
+
+// NAME=ARCHIVES, e.g. "ssd=0,1,4-7"
+static bool parseDevice(const std::string &assignment, std::vector< std::pair<uint16_t, std::string> > &devices) {
+	size_t eq = assignment.find('=');
+	if (eq == std::string::npos || eq == 0) return false;
+	std::string name = assignment.substr(0, eq);
+
+	std::vector<std::string> ranges;
+	boost::split(ranges, assignment.substr(eq + 1), boost::is_any_of(","));
+	for (std::vector<std::string>::const_iterator i = ranges.begin(); i != ranges.end(); ++ i) {
+		size_t dash = i->find('-');
+		unsigned int first, last;
+		if (!parseArchive(i->substr(0, dash), first)) return false;
+		if (dash == std::string::npos) {
+			last = first;
+		}
+		else if (!parseArchive(i->substr(dash + 1), last) || last < first) {
+			return false;
+		}
+		for (unsigned int index = first; index <= last; ++ index) {
+			devices.push_back(std::make_pair((uint16_t) index, name));
+		}
+	}
+	return true;
+}
+
 int main(int argc, char *argv[]) {
 	po::options_description desc("Options");
 	desc.add_options()
@@ -314,8 +357,19 @@ int main(int argc, char *argv[]) {
 		("human-readable,h", "use human readable file sizes in listing")
 		("check,c",          "check CRC32 sums")
 		("xcheck,x",         "extract and check CRC32 sums")
+		("verify-md5",       "check the MD5 sums of version 2 packages")
 		("directory,C",      po::value<std::string>(), "extract files into another directory")
+		("tar",              po::value<std::string>(), "write the files as a tar archive to this file (- for stdout) instead of extracting them, with -x also check CRC32 sums")
+		("cat",              "write the data of the given FILEs to stdout, only their directories are read")
+		("bundle",           po::value<std::string>(), "like --tar but gzip compressed in blocks by jobs threads, with an index for random access in FILE.idx")
 		("stop,s",           "stop on error")
+		("jobs,j",           po::value<unsigned int>(), "number of worker threads (default: number of cores)")
+		("device",           po::value< std::vector<std::string> >(), "NAME=ARCHIVES: read these archives (comma separated indices or ranges like 3-5) as one device, by default archives are grouped by the device they are stored on")
+		("device-jobs",      po::value<unsigned int>(), "worker threads per device (default: jobs split among the devices)")
+		("sync",             "sync the file system after extracting")
+		("io-uring",         "use io_uring for checking and extracting if the kernel supports it")
+		("pipeline",         "read, check and write on separate threads when checking and extracting and print how busy each was")
+		("cache-dir",        po::value<std::string>(), "cache parsed indices in this directory")
 		("stats",            "print some statistics and coverage analysis of archive data (archive debugging)")
 		("all,a",            "also show archives with 100% coverage in statistics")
 		("dump-uncovered",   "dump uncovered areas into files (implies --stats, archive debugging)");
@@ -355,14 +409,17 @@ int main(int argc, char *argv[]) {
 	bool list          = vm.count("list")           > 0;
 	bool check         = vm.count("check")          > 0;
 	bool xcheck        = vm.count("xcheck")         > 0;
+	bool verifymd5     = vm.count("verify-md5")     > 0;
 	bool stop          = vm.count("stop")           > 0;
 	bool stats         = vm.count("stats")          > 0;
 	bool dump          = vm.count("dump-uncovered") > 0;
 	bool humanreadable = vm.count("human-readable") > 0;
 	bool printall      = vm.count("all")            > 0;
+	bool cat           = vm.count("cat")            > 0;
 
 	std::string directory = vm.count("directory") > 0 ? vm["directory"].as<std::string>() : std::string(".");
 	std::string archive   = vm.count("archive")   > 0 ? vm["archive"].as<std::string>()   : std::string("-");
+	std::string cachedir  = vm.count("cache-dir") > 0 ? vm["cache-dir"].as<std::string>() : std::string();
 	std::vector<std::string> filter;
 	SortKeys sorting;
 	
@@ -415,12 +472,43 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	std::vector< std::pair<uint16_t, std::string> > devices;
+	if (vm.count("device") > 0) {
+		const std::vector<std::string> &assignments = vm["device"].as< std::vector<std::string> >();
+		for (std::vector<std::string>::const_iterator i = assignments.begin(); i != assignments.end(); ++ i) {
+			if (!parseDevice(*i, devices)) {
+				std::cerr << "*** error: illegal device assignment: \"" << *i << "\"\n";
+				return 1;
+			}
+		}
+	}
+
 	ConsoleHandler handler(stop);
 	Package package(&handler);
 
 	try {
+		// only the filtered directories need to be loaded
+		package.setLazy(!filter.empty());
+		package.setCacheDir(cachedir);
+		package.setUring(vm.count("io-uring") > 0);
+		package.setPipeline(vm.count("pipeline") > 0);
+		package.setSync(vm.count("sync") > 0);
+		if (vm.count("jobs") > 0) {
+			package.setThreads(vm["jobs"].as<unsigned int>());
+		}
+		if (vm.count("device-jobs") > 0) {
+			package.setDeviceThreads(vm["device-jobs"].as<unsigned int>());
+		}
+		for (size_t i = 0; i < devices.size(); ++ i) {
+			package.setDevice(devices[i].first, devices[i].second);
+		}
 		package.read(archive);
 
+		if (cat) {
+			catFiles(package, filter);
+			return 0;
+		}
+
 		if (!filter.empty()) {
 			package.filter(filter);
 		}
@@ -431,12 +519,37 @@ int main(int argc, char *argv[]) {
 		else if (list) {
 			printListing(package, humanreadable, sorting);
 		}
+		else if (vm.count("tar") > 0) {
+			std::string tarfile = vm["tar"].as<std::string>();
+			time_t mtime = fs::last_write_time(archive);
+			boost::scoped_ptr<TarDataHandlerFactory> factory;
+			if (tarfile == "-") {
+				// progress goes to stderr so the stream stays clean
+				std::cout.rdbuf(std::cerr.rdbuf());
+				factory.reset(new TarDataHandlerFactory(STDOUT_FILENO, xcheck, mtime));
+			}
+			else {
+				factory.reset(new TarDataHandlerFactory(tarfile, xcheck, mtime));
+			}
+			package.process(*factory);
+			factory->finish();
+		}
+		else if (vm.count("bundle") > 0) {
+			std::string bundlefile = vm["bundle"].as<std::string>();
+			GzipBundle bundle(bundlefile, package.threads());
+			TarDataHandlerFactory factory(bundle, xcheck, fs::last_write_time(archive));
+			package.process(factory);
+			factory.finish();
+		}
 		else if (xcheck) {
 			package.extract(directory, true);
 		}
 		else if (check) {
 			package.check();
 		}
+		else if (verifymd5) {
+			package.verifyMd5();
+		}
 		else {
 			package.extract(directory, false);
 		}
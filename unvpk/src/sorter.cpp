@@ -30,8 +30,8 @@ bool Vpk::Sorter::operator () (const ListEntry &lhs, const ListEntry &rhs) const
 			break;
 		}
 		case SORT_CRC32:
-			if (lhs.file->crc32 != rhs.file->crc32) {
-				return lhs.file->crc32 < rhs.file->crc32;
+			if (lhs.crc32() != rhs.crc32()) {
+				return lhs.crc32() < rhs.crc32();
 			}
 			break;
 		case SORT_OFF: {
@@ -43,8 +43,8 @@ bool Vpk::Sorter::operator () (const ListEntry &lhs, const ListEntry &rhs) const
 			break;
 		}
 		case SORT_SIZE: {
-			size_t lsize = lhs.file->size + lhs.file->preload.size();
-			size_t rsize = rhs.file->size + rhs.file->preload.size();
+			size_t lsize = lhs.size();
+			size_t rsize = rhs.size();
 			if (lsize != rsize) {
 				return lsize < rsize;
 			}
@@ -64,8 +64,8 @@ bool Vpk::Sorter::operator () (const ListEntry &lhs, const ListEntry &rhs) const
 			break;
 		}
 		case SORT_RCRC32:
-			if (lhs.file->crc32 != rhs.file->crc32) {
-				return lhs.file->crc32 > rhs.file->crc32;
+			if (lhs.crc32() != rhs.crc32()) {
+				return lhs.crc32() > rhs.crc32();
 			}
 			break;
 		case SORT_ROFF: {
@@ -77,8 +77,8 @@ bool Vpk::Sorter::operator () (const ListEntry &lhs, const ListEntry &rhs) const
 			break;
 		}
 		case SORT_RSIZE: {
-			size_t lsize = lhs.file->size + lhs.file->preload.size();
-			size_t rsize = rhs.file->size + rhs.file->preload.size();
+			size_t lsize = lhs.size();
+			size_t rsize = rhs.size();
 			if (lsize != rsize) {
 				return lsize > rsize;
 			}
@@ -63,12 +63,16 @@ namespace Vpk {
 
 		const std::string &archive()    const { return m_archive; }
 		const std::string &mountpoint() const { return m_mountpoint; }
+		const std::string &cachedir()   const { return m_cachedir; }
+		void setCachedir(const std::string &cachedir) { m_cachedir = cachedir; }
+		bool icase() const { return m_icase; }
+		void setIcase(bool icase) { m_icase = icase; }
 
 		void clear();
 	
 	private:
 		void setup();
-		void statfs(const Node *node);
+		void statfs(const Package &package);
 
 		typedef boost::unordered_map<uint16_t,int> Archives;
 		typedef boost::unordered_set<uint16_t> Indices;
@@ -77,10 +81,11 @@ namespace Vpk {
 		int                    m_flags;
 		std::string            m_archive;
 		std::string            m_mountpoint;
+		std::string            m_cachedir;
+		bool                   m_icase;
 		ConsoleHandler         m_handler;
 		Package                m_package;
 		Archives               m_archives;
-		fsfilcnt_t             m_files;
 		Indices                m_indices;
 		struct fuse_operations m_operations;
 	};
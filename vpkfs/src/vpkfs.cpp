@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <memory.h>
+#include <string.h>
 #include <sys/xattr.h>
 #include <endian.h>
 #include <stdint.h>
@@ -50,21 +51,29 @@ struct vpkfuse_config {
 	vpkfuse_config(
 		std::string &archive,
 		std::string &mountpoint,
+		std::string &cachedir,
+		bool &icase,
 		int &flags)
 	: archive(archive),
 	  mountpoint(mountpoint),
+	  cachedir(cachedir),
+	  icase(icase),
 	  argind(0),
 	  flags(flags) {}
 
 	std::string &archive;
 	std::string &mountpoint;
+	std::string &cachedir;
+	bool &icase;
 	int argind;
 	int &flags;
 };
 
 enum {
 	KEY_HELP,
-	KEY_VERSION
+	KEY_VERSION,
+	KEY_CACHE_DIR,
+	KEY_ICASE
 };
 
 static struct fuse_opt vpkfuse_opts[] = {
@@ -72,6 +81,8 @@ static struct fuse_opt vpkfuse_opts[] = {
 	FUSE_OPT_KEY("--version", KEY_VERSION),
 	FUSE_OPT_KEY("-h",        KEY_HELP),
 	FUSE_OPT_KEY("--help",    KEY_HELP),
+	FUSE_OPT_KEY("cache_dir=", KEY_CACHE_DIR),
+	FUSE_OPT_KEY("icase",      KEY_ICASE),
 	FUSE_OPT_END
 };
 
@@ -91,6 +102,8 @@ void usage(const char *binary) {
 		"                           Note that this might actually increase\n"
 		"                           performance in case you access the\n"
 		"                           filesystem with only one process.\n"
+		"    -o cache_dir=DIR       cache parsed indices in DIR\n"
+		"    -o icase               case insensitive path lookup\n"
 		"\n"
 		"(c) 2011 Mathias Panzenböck\n";
 }
@@ -126,6 +139,14 @@ static int vpkfuse_opt_proc(struct vpkfuse_config *conf, const char *arg, int ke
 		std::cout << "vpkfs version " << Vpk::VERSION << std::endl;
 		conf->flags |= VPK_OPTS_VERSION;
 		break;
+
+	case KEY_CACHE_DIR:
+		conf->cachedir = arg + strlen("cache_dir=");
+		return 0;
+
+	case KEY_ICASE:
+		conf->icase = true;
+		return 0;
 	}
 	return 1;
 }
@@ -133,10 +154,10 @@ static int vpkfuse_opt_proc(struct vpkfuse_config *conf, const char *arg, int ke
 Vpk::Vpkfs::Vpkfs(int argc, char *argv[], bool allocated)
 		: m_args(argc, argv, allocated),
 		  m_flags(VPK_OPTS_OK),
+		  m_icase(false),
 		  m_handler(true),
-		  m_package(&this->m_handler),
-		  m_files(0) {
-	struct vpkfuse_config conf(m_archive, m_mountpoint, m_flags);
+		  m_package(&this->m_handler) {
+	struct vpkfuse_config conf(m_archive, m_mountpoint, m_cachedir, m_icase, m_flags);
 	m_args.parse(&conf, vpkfuse_opts, vpkfuse_opt_proc);
 	
 	if (m_flags == VPK_OPTS_OK) {
@@ -153,6 +174,10 @@ Vpk::Vpkfs::Vpkfs(int argc, char *argv[], bool allocated)
 	}
 
 	m_archive = fs::absolute(m_archive).string();
+	if (!m_cachedir.empty()) {
+		// fuse changes into / when daemonizing
+		m_cachedir = fs::absolute(m_cachedir).string();
+	}
 	setup();
 }
 
@@ -164,9 +189,9 @@ Vpk::Vpkfs::Vpkfs(
 		: m_flags(VPK_OPTS_OK),
 		  m_archive(archive),
 		  m_mountpoint(mountpoint),
+		  m_icase(false),
 		  m_handler(true),
-		  m_package(&this->m_handler),
-		  m_files(0) {
+		  m_package(&this->m_handler) {
 	m_args.add_arg("vpkfs");
 	if (singlethreaded) {
 		m_args.add_arg("-s");
@@ -267,20 +292,10 @@ void Vpk::Vpkfs::setup() {
 #endif
 }
 
-void Vpk::Vpkfs::statfs(const Node *node) {
-	++ m_files;
-	if (node->type() == Node::DIR) {
-		const Nodes &nodes = ((const Dir*) node)->nodes();
-		for (Nodes::const_iterator i = nodes.begin(); i != nodes.end(); ++ i) {
-			statfs(i->second.get());
-		}
-	}
-	else {
-		uint16_t arch = ((const File*) node)->index;
-		if (m_indices.find(arch) == m_indices.end()) {
-			m_indices.insert(arch);
-		}
-	}
+void Vpk::Vpkfs::statfs(const Package &package) {
+	std::vector<uint16_t> archives;
+	package.archives(archives);
+	m_indices.insert(archives.begin(), archives.end());
 }
 
 int Vpk::Vpkfs::run() {
@@ -293,11 +308,15 @@ int Vpk::Vpkfs::run() {
 void Vpk::Vpkfs::init() {
 	clear();
 	m_handler.setRaise(true);
+	// directories are loaded on first access from any of the FUSE
+	// threads, Vpk::Package serializes that
+	m_package.setLazy(true);
+	m_package.setCacheDir(m_cachedir);
+	m_package.setIcase(m_icase);
 	m_package.read(m_archive);
 	m_handler.setRaise(false);
 
-	m_files = 0;
-	statfs(&m_package);
+	statfs(m_package);
 
 	for (Indices::const_iterator i = m_indices.begin(); i != m_indices.end(); ++ i) {
 		uint16_t index = *i;
@@ -325,7 +344,7 @@ static struct stat *vpk_stat(const Vpk::Node *node, struct stat *stbuf) {
 		const Vpk::File *file = (const Vpk::File*) node;
 		stbuf->st_mode  = S_IFREG | 0444;
 		stbuf->st_nlink = 1;
-		stbuf->st_size  = file->preload.size() + file->size;
+		stbuf->st_size  = file->preloadSize() + file->size();
 	}
 	return stbuf;
 }
@@ -342,8 +361,8 @@ int Vpk::Vpkfs::getattr(const char *path, struct stat *stbuf) {
 
 	struct stat archst;
 	int code = 0;
-	if (node->type() == Vpk::Node::FILE && ((File*) node)->size) {
-		int fd = m_archives[((File*) node)->index];
+	if (node->type() == Vpk::Node::FILE && ((File*) node)->size()) {
+		int fd = m_archives[((File*) node)->index()];
 		code = fstat(fd, &archst);
 	}
 	else {
@@ -396,8 +415,8 @@ int Vpk::Vpkfs::readdir(const char *, void *buf, fuse_fill_dir_t filler,
 
 	const Nodes &nodes = dir->nodes();
 	for (Nodes::const_iterator i = nodes.begin(); i != nodes.end(); ++ i) {
-		const Node *child = i->second.get();
-		if (filler(buf, child->name().c_str(), vpk_stat(child, &stbuf), 0)) return 0;
+		const Node *child = i->second;
+		if (filler(buf, child->name(), vpk_stat(child, &stbuf), 0)) return 0;
 	}
 
 	return 0;
@@ -427,22 +446,22 @@ int Vpk::Vpkfs::read(const char *, char *buf, size_t size, off_t offset,
 
 	File *file = (File *) fi->fh;
 
-	size_t preloadSize = file->preload.size();
-	size_t fileSize = preloadSize + file->size;
+	size_t preloadSize = file->preloadSize();
+	size_t fileSize = preloadSize + file->size();
 
 	if ((size_t)offset >= fileSize) return 0;
 
 	size_t count = 0;
 	if ((size_t)offset < preloadSize) {
 		count = std::min(size, preloadSize - offset);
-		memcpy(buf, &file->preload[offset], count);
+		memcpy(buf, file->preload() + offset, count);
 	}
 
 	size_t rest = std::min(size - count, fileSize - offset - count);
 	if (rest) {
-		int fd = m_archives[file->index];
+		int fd = m_archives[file->index()];
 		ssize_t restcount = pread(fd, buf + count, rest,
-			file->offset + (offset + count - preloadSize));
+			file->offset() + (offset + count - preloadSize));
 
 		if (restcount < 0) {
 			return -errno;
@@ -461,8 +480,8 @@ int Vpk::Vpkfs::read_buf(const char *, struct fuse_bufvec **bufp,
 	File *file = (File *) fi->fh;
 	struct fuse_bufvec *bufvec = NULL;
 
-	size_t preloadSize = file->preload.size();
-	size_t fileSize = preloadSize + file->size;
+	size_t preloadSize = file->preloadSize();
+	size_t fileSize = preloadSize + file->size();
 
 	size_t count = 0;
 	if ((size_t)offset >= fileSize) {
@@ -474,7 +493,7 @@ int Vpk::Vpkfs::read_buf(const char *, struct fuse_bufvec **bufp,
 		count = std::min(size, preloadSize - offset);
 		void *buf = malloc(count);
 		if (!buf) return -ENOMEM;
-		memcpy(buf, &file->preload[offset], count);
+		memcpy(buf, file->preload() + offset, count);
 
 		size_t rest = std::min(size - count, fileSize - offset - count);
 		if (rest) {
@@ -490,8 +509,8 @@ int Vpk::Vpkfs::read_buf(const char *, struct fuse_bufvec **bufp,
 			bufvec->buf[0].fd    = -1;
 			bufvec->buf[1].size  = rest;
 			bufvec->buf[1].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
-			bufvec->buf[1].fd    = m_archives[file->index];
-			bufvec->buf[1].pos   = file->offset + (offset + count - preloadSize);
+			bufvec->buf[1].fd    = m_archives[file->index()];
+			bufvec->buf[1].pos   = file->offset() + (offset + count - preloadSize);
 
 			count += rest;
 		}
@@ -513,8 +532,8 @@ int Vpk::Vpkfs::read_buf(const char *, struct fuse_bufvec **bufp,
 		bufvec->count        = 1;
 		bufvec->buf[0].size  = count = std::min(size, fileSize - offset);
 		bufvec->buf[0].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
-		bufvec->buf[0].fd    = m_archives[file->index];
-		bufvec->buf[0].pos   = file->offset + (offset - preloadSize);
+		bufvec->buf[0].fd    = m_archives[file->index()];
+		bufvec->buf[0].pos   = file->offset() + (offset - preloadSize);
 	}
 
 	*bufp = bufvec;
@@ -534,7 +553,9 @@ int Vpk::Vpkfs::statfs(const char *, struct statvfs *stbuf) {
 
 	fssize = archst.st_size;
 	stbuf->f_bsize   = archst.st_blksize;
-	stbuf->f_files   = m_files;
+	// + 1 for the root directory, duplicates are only known (and not
+	// counted anymore) once their directory is loaded
+	stbuf->f_files   = m_package.filecount() + m_package.dircount() + 1;
 	stbuf->f_namemax = std::numeric_limits<unsigned long>::max();
 	
 	for (boost::unordered_set<uint16_t>::const_iterator i = m_indices.begin();
@@ -581,7 +602,7 @@ int Vpk::Vpkfs::listxattr(const char *path, char *buf, size_t size) {
 		xattrs_size = sizeof(VPK_XATTRS_DIR);
 		xattrs_list = VPK_XATTRS_DIR;
 	}
-	else if (((File*) node)->size) {
+	else if (((File*) node)->size()) {
 		xattrs_size = sizeof(VPK_XATTRS_ARCHIVED);
 		xattrs_list = VPK_XATTRS_ARCHIVED;
 	}
@@ -638,22 +659,22 @@ int Vpk::Vpkfs::getxattr(const char *path, const char *name, char *buf, size_t s
 	else {
 		File *file = (File*) node;
 		if (strcmp(name, "user.vpkfs.crc32") == 0) {
-			return ::getxattr(file->crc32, buf, size);
+			return ::getxattr(file->crc32(), buf, size);
 		}
 		else if (strcmp(name, "user.vpkfs.preload_size") == 0) {
-			return ::getxattr((uint16_t) file->preload.size(), buf, size);
+			return ::getxattr((uint16_t) file->preloadSize(), buf, size);
 		}
-		else if (!file->size) {
+		else if (!file->size()) {
 			return -ENODATA;
 		}
 		else if (strcmp(name, "user.vpkfs.archive_index") == 0) {
-			return ::getxattr(file->index, buf, size);
+			return ::getxattr(file->index(), buf, size);
 		}
 		else if (strcmp(name, "user.vpkfs.archive_path") == 0) {
-			return ::getxattr(m_package.archivePath(file->index).string(), buf, size);
+			return ::getxattr(m_package.archivePath(file->index()).string(), buf, size);
 		}
 		else if (strcmp(name, "user.vpkfs.offset") == 0) {
-			return ::getxattr(file->offset, buf, size);
+			return ::getxattr(file->offset(), buf, size);
 		}
 		else {
 			return -ENODATA;